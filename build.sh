@@ -1,3 +1,25 @@
 #!/bin/sh
-clang `pkg-config --cflags raylib` -o pen src/pen.c src/main.c `pkg-config --libs raylib` -lm
-clang -nostdlib --target=wasm32 -Wl,--no-entry -Wl,--export=penInit -Wl,--export=penRender -Wl,--export=penUpdate -Wl,--allow-undefined -o web/pen.wasm src/pen.c
+# DISPATCH=switch|threaded|register ./build.sh selects the interpreter
+FLAGS=""
+case "${DISPATCH:-threaded}" in
+  threaded) FLAGS="-DELANG_THREADED" ;;
+  register) FLAGS="-DELANG_REGISTER" ;;
+esac
+
+# FUSE=0 disables superinstructions, COUNT=1 prints the dispatch count per run
+if [ "${FUSE:-1}" = "1" ]; then
+  FLAGS="$FLAGS -DELANG_FUSE"
+fi
+
+if [ "${COUNT:-0}" = "1" ]; then
+  FLAGS="$FLAGS -DELANG_COUNT"
+fi
+
+# JIT=1 compiles scripts to x86-64 code, the wasm build always interprets
+JIT_FLAGS=""
+if [ "${JIT:-0}" = "1" ]; then
+  JIT_FLAGS="-DELANG_JIT"
+fi
+
+clang $FLAGS $JIT_FLAGS -DELANG_AOT `pkg-config --cflags raylib` -o pen src/pen.c src/raster.c src/batch.c src/svg.c src/main.c `pkg-config --libs raylib` -lm -lpthread
+clang $FLAGS -nostdlib --target=wasm32 -Wl,--no-entry -Wl,--export=penInit -Wl,--export=penRender -Wl,--export=penUpdate -Wl,--export=penGeneration -Wl,--allow-undefined -o web/pen.wasm src/pen.c
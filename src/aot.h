@@ -0,0 +1,328 @@
+#ifndef AOT_H
+#define AOT_H
+
+// C backend for elang, included by elang.h when ELANG_AOT is defined.
+// Every function becomes a C function whose locals and stack temporaries are C
+// variables, the top level becomes elangProgram(). The frame pointer of the
+// stack VM is still passed around so stack overflows are reported as before.
+// Globals live in an AotProgram on the stack of elangProgram(), so it can run
+// on several VMs at once.
+
+void aotFloat(FILE *file, float value) {
+  if (value - value != 0) {
+    union {
+      float f;
+      unsigned int u;
+    } bits = {.f = value};
+
+    fprintf(file, "aotBits(0x%08xu)", bits.u);
+  } else {
+    fprintf(file, "%af", value);
+  }
+}
+
+void aotCall(ElangVM *vm, FILE *file, int depth, Function *f, int index, int local) {
+  int arity = f->arity;
+  if (f->start < 0) {
+    fprintf(file, "  {\n    float a[] = {");
+    for (int j = 0; j < arity; j++) {
+      fprintf(file, "%ss%d", j ? ", " : "", depth - arity + j);
+    }
+    fprintf(file, "%s};\n", arity ? "" : "0");
+    fprintf(file, "    s%d = elangVMNative(p->vm, %d)(p->vm, a); // %.*s\n  }\n", depth - arity,
+            -f->start - 1, f->name.count, f->name.data);
+    return;
+  }
+
+  int base = depth - arity;
+  if (local >= 0) {
+    base += vm->functions[local].body + 2;
+    fprintf(file, "  s%d = f%d(p, fp + %d", depth - arity, index, base);
+  } else {
+    fprintf(file, "  s%d = f%d(p, %d", depth - arity, index, base);
+  }
+
+  for (int j = 0; j < arity; j++) {
+    fprintf(file, ", s%d", depth - arity + j);
+  }
+  fprintf(file, ");\n  if (p->failed) {\n    return 0;\n  }\n");
+}
+
+// Emits ops[start..end), skipping the bodies of nested function definitions
+int aotEmit(ElangVM *vm, FILE *file, int start, int end, int local) {
+  int depth = 0;
+  int next = vm->nativesCount;
+  for (int i = start; i < end; i++) {
+    while (next < vm->functionsCount && vm->functions[next].start < i) {
+      next++;
+    }
+
+    if (local < 0 && next < vm->functionsCount && vm->functions[next].start == i) {
+      i = vm->ops[i - 1].data - 1;
+      continue;
+    }
+
+    if (vm->aotTarget[i]) {
+      fprintf(file, "L%d:\n", i);
+    }
+
+    Op op = vm->ops[i];
+    int index = op.data;
+    char *binary = 0;
+    switch (op.type) {
+    case OP_NUM:
+      fprintf(file, "  s%d = ", depth);
+      aotFloat(file, vm->consts[op.data]);
+      fprintf(file, ";\n");
+      break;
+
+    case OP_GT:
+      binary = ">";
+      break;
+
+    case OP_GE:
+      binary = ">=";
+      break;
+
+    case OP_LT:
+      binary = "<";
+      break;
+
+    case OP_LE:
+      binary = "<=";
+      break;
+
+    case OP_EQ:
+      binary = "==";
+      break;
+
+    case OP_NE:
+      binary = "!=";
+      break;
+
+    case OP_ADD:
+      binary = "+";
+      break;
+
+    case OP_SUB:
+      binary = "-";
+      break;
+
+    case OP_MUL:
+      binary = "*";
+      break;
+
+    case OP_DIV:
+      binary = "/";
+      break;
+
+    case OP_NOT:
+      fprintf(file, "  s%d = !s%d;\n", depth - 1, depth - 1);
+      break;
+
+    case OP_NEG:
+      fprintf(file, "  s%d = -s%d;\n", depth - 1, depth - 1);
+      break;
+
+    case OP_ELSE:
+      fprintf(file, "  if (!s%d) {\n    goto L%d;\n  }\n", depth - 1, index);
+      break;
+
+    case OP_GOTO:
+      fprintf(file, "  goto L%d;\n", index);
+      break;
+
+    case OP_CALL:
+    case OP_NATIVE:
+      aotCall(vm, file, depth, &vm->functions[index], index, local);
+      break;
+
+    case OP_RETURN:
+      fprintf(file, "  return s%d;\n", depth - 1);
+      break;
+
+    case OP_DROP:
+      break;
+
+    case OP_GETG:
+      fprintf(file, "  s%d = p->g[%d];\n", depth, index);
+      break;
+
+    case OP_SETG:
+      fprintf(file, "  p->g[%d] = s%d;\n", index, depth - 1);
+      break;
+
+    case OP_GETL:
+      fprintf(file, "  s%d = l%d;\n", depth, index);
+      break;
+
+    case OP_SETL:
+      fprintf(file, "  l%d = s%d;\n", index, depth - 1);
+      break;
+
+    default:
+      return 0;
+    }
+
+    if (binary) {
+      fprintf(file, "  s%d = s%d %s s%d;\n", depth - 2, depth - 2, binary, depth - 1);
+    }
+    depth += opsEffect(vm, op.type, op.data);
+  }
+
+  if (local < 0 && vm->aotTarget[end]) {
+    fprintf(file, "L%d:\n", end);
+  }
+  return 1;
+}
+
+void aotTemps(FILE *file, int depth) {
+  for (int i = 0; i < depth; i++) {
+    fprintf(file, "%ss%d", i ? ", " : "  float ", i);
+  }
+
+  if (depth) {
+    fprintf(file, ";\n");
+  }
+}
+
+void aotSignature(ElangVM *vm, FILE *file, int index) {
+  Function *f = &vm->functions[index];
+  fprintf(file, "static float f%d(AotProgram *p, int fp", index);
+  for (int i = 0; i < f->arity; i++) {
+    fprintf(file, ", float l%d", i);
+  }
+  fprintf(file, ")");
+}
+
+int elangVMEmitC(ElangVM *vm, char *data, int size, FILE *file) {
+  if (!compileProgram(vm, data, size)) {
+    return 0;
+  }
+
+  vm->aotTarget = ARENA_ARRAY(char, vm->opsCount + 1);
+  if (!vm->aotTarget) {
+    return 0;
+  }
+
+  int globals = 0;
+  int depth = 0;
+  int bits = 0;
+  int state = 0;
+  for (int i = 0; i <= vm->opsCount; i++) {
+    vm->aotTarget[i] = 0;
+  }
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    Op op = vm->ops[i];
+    if (op.type == OP_ELSE || op.type == OP_GOTO) {
+      vm->aotTarget[op.data] = 1;
+    }
+
+    if ((op.type == OP_GETG || op.type == OP_SETG) && globals <= op.data) {
+      globals = op.data + 1;
+    }
+
+    if (op.type == OP_NUM && vm->consts[op.data] - vm->consts[op.data] != 0) {
+      bits = 1;
+    }
+  }
+
+  int next = vm->nativesCount;
+  for (int i = 0, d = 0; i < vm->opsCount; i++) {
+    if (next < vm->functionsCount && vm->functions[next].start == i) {
+      i = vm->ops[i - 1].data - 1;
+      next++;
+      continue;
+    }
+
+    Op op = vm->ops[i];
+    if (op.type == OP_GETG || op.type == OP_SETG || op.type == OP_CALL || op.type == OP_NATIVE) {
+      state = 1;
+    }
+
+    d += opsEffect(vm, op.type, op.data);
+    if (depth < d) {
+      depth = d;
+    }
+  }
+
+  fprintf(file, "// Generated by elangEmitC(), link against the program's natives\n");
+  fprintf(file, "#ifdef __clang__\n#pragma STDC FP_CONTRACT OFF\n#endif\n\n");
+  fprintf(file, "#include \"elang.h\"\n\n");
+  fprintf(file, "#define STACK_LIMIT %d\n\n", vm->stackLimit);
+
+  fprintf(file, "char elangSource[] = \"");
+  for (int i = 0; i < size; i++) {
+    unsigned char ch = data[i];
+    if (ch == '\\' || ch == '"') {
+      fprintf(file, "\\%c", ch);
+    } else if (ch == '\n') {
+      fprintf(file, "\\n\"\n                    \"");
+    } else if (ch < ' ' || ch > '~') {
+      fprintf(file, "\\%03o", ch);
+    } else {
+      fputc(ch, file);
+    }
+  }
+  fprintf(file, "\";\n\n");
+
+  fprintf(file, "typedef struct {\n  ElangVM *vm;\n  int failed;\n");
+  if (globals) {
+    fprintf(file, "  float g[%d];\n", globals);
+  }
+  fprintf(file, "} AotProgram;\n\n");
+
+  if (bits) {
+    fprintf(file, "static float aotBits(unsigned int u) {\n");
+    fprintf(file, "  union {\n    unsigned int u;\n    float f;\n  } bits = {.u = u};\n");
+    fprintf(file, "  return bits.f;\n}\n\n");
+  }
+
+  if (vm->functionsCount > vm->nativesCount) {
+    fprintf(file, "static void aotOverflow(AotProgram *p) {\n");
+    fprintf(file, "  platformErrorStart();\n");
+    fprintf(file, "  platformErrorPush(\"Stack overflow\", 14);\n");
+    fprintf(file, "  platformErrorEnd();\n");
+    fprintf(file, "  p->failed = 1;\n}\n\n");
+  }
+
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    aotSignature(vm, file, i);
+    fprintf(file, ";\n");
+  }
+
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    Function *f = &vm->functions[i];
+    int end = vm->ops[f->start - 1].data;
+
+    fprintf(file, "\n// %.*s\n", f->name.count, f->name.data);
+    aotSignature(vm, file, i);
+    fprintf(file, " {\n");
+    for (int j = f->arity; j < f->body; j++) {
+      fprintf(file, "  float l%d = 0;\n", j);
+    }
+    aotTemps(file, f->depth);
+
+    fprintf(file, "  if (fp + %d > STACK_LIMIT) {\n", f->body + 2 + f->depth);
+    fprintf(file, "    aotOverflow(p);\n    return 0;\n  }\n");
+
+    if (!aotEmit(vm, file, f->start, end, i)) {
+      return 0;
+    }
+    fprintf(file, "}\n");
+  }
+
+  fprintf(file, "\nint elangProgram(ElangVM *vm) {\n");
+  if (state) {
+    fprintf(file, "  AotProgram program = {.vm = vm};\n  AotProgram *p = &program;\n");
+  }
+  aotTemps(file, depth);
+  if (!aotEmit(vm, file, 0, vm->opsCount, -1)) {
+    return 0;
+  }
+  fprintf(file, "  return 1;\n}\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,400 @@
+#include "batch.h"
+#include "pen.h"
+#include "raster.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH_WIDTH 800
+#define BATCH_HEIGHT 600
+#define BATCH_ERROR_CAP 256
+
+// Job
+typedef struct {
+  char *name;
+  int ok;
+  int replayed;
+  double compile;
+  double run;
+  double render;
+  char error[BATCH_ERROR_CAP];
+} Job;
+
+double jobNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Scripts are mapped instead of read, bytecode then runs from the mapping
+char *jobMap(char *path, int *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  char *data = 0;
+  struct stat st;
+  if (!fstat(fd, &st) && st.st_size < INT_MAX) {
+    *size = st.st_size;
+    data = st.st_size ? mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    if (data == MAP_FAILED) {
+      data = 0;
+    }
+  }
+
+  close(fd);
+  return data;
+}
+
+void jobUnmap(char *data, int size) {
+  if (size) {
+    munmap(data, size);
+  }
+}
+
+// Queue
+// Every worker owns a deque of job indices. It takes work from the back of its
+// own deque and, once that is empty, steals from the front of the others.
+typedef struct {
+  pthread_mutex_t lock;
+  int *items;
+  int head;
+  int tail;
+} Queue;
+
+int queuePop(Queue *queue) {
+  int index = -1;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail) {
+    index = queue->items[--queue->tail];
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return index;
+}
+
+int queueSteal(Queue *queue) {
+  int index = -1;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail) {
+    index = queue->items[queue->head++];
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return index;
+}
+
+// Batch
+typedef struct {
+  Job *jobs;
+  Queue *queues;
+  int workers;
+  int threads;
+  int smooth;
+  long long fuel;
+  int timeLimit;
+  char *input;
+  char *output;
+} Batch;
+
+typedef struct {
+  Batch *batch;
+  int id;
+} Worker;
+
+_Thread_local Raster *batchRaster;
+_Thread_local Job *batchJob;
+_Thread_local int batchErrorCount;
+
+// Set when the raster could not take a line, the image is then incomplete
+_Thread_local int batchFailed;
+
+int batchActive(void) {
+  return batchRaster != 0;
+}
+
+void batchErrorStart(void) {
+  batchErrorCount = 0;
+}
+
+void batchErrorPush(char *data, int count) {
+  Job *job = batchJob;
+  for (int i = 0; i < count && batchErrorCount + 1 < BATCH_ERROR_CAP; i++) {
+    job->error[batchErrorCount++] = data[i];
+  }
+  job->error[batchErrorCount] = '\0';
+}
+
+// Scripts are streamed into the raster while they run, so the points of a long
+// script are never all held at once
+void batchSink(void *context, float *xs, float *ys, int count) {
+  Raster *raster = context;
+  int w = raster->width / 2;
+  int h = raster->height / 2;
+  for (int i = 1; i < count && !batchFailed; i++) {
+    if (!rasterPushLine(raster, w + (int)xs[i - 1], h + (int)ys[i - 1], w + (int)xs[i],
+                        h + (int)ys[i])) {
+      batchFailed = 1;
+    }
+  }
+  rasterFlush(raster);
+}
+
+void batchRun(Batch *batch, Pen *pen, Job *job) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", batch->input, job->name);
+
+  int size = 0;
+  char *data = jobMap(path, &size);
+  if (!data) {
+    snprintf(job->error, sizeof(job->error), "could not read the script");
+    return;
+  }
+
+  // A script the same as the last one the worker ran is still in the raster,
+  // unless it was not drawn whole
+  job->replayed = !batchFailed && penReplay(pen, data, size);
+  if (!job->replayed) {
+    rasterClear(batchRaster);
+    batchFailed = 0;
+  }
+
+  double start = jobNow();
+  int ok = job->replayed || penCompile(pen, data, size);
+  double compiled = jobNow();
+  ok = ok && (job->replayed || penRun(pen));
+  double ran = jobNow();
+  job->compile = compiled - start;
+  job->run = ran - compiled;
+  jobUnmap(data, size);
+
+  if (!ok) {
+    return;
+  }
+
+  if (batchFailed) {
+    snprintf(job->error, sizeof(job->error), "out of memory while drawing");
+    return;
+  }
+
+  // Replace the extension of the script, if any
+  char *dot = strrchr(job->name, '.');
+  int stem = dot && dot != job->name ? dot - job->name : (int)strlen(job->name);
+  snprintf(path, sizeof(path), "%s/%.*s.pgm", batch->output, stem, job->name);
+  if (!rasterWrite(batchRaster, path)) {
+    snprintf(job->error, sizeof(job->error), "could not write the image");
+    return;
+  }
+
+  job->render = jobNow() - ran;
+  job->ok = 1;
+}
+
+void *batchWorker(void *arg) {
+  Worker *worker = arg;
+  Batch *batch = worker->batch;
+
+  Raster raster;
+  Pen *pen = penCreate();
+  if (!rasterInit(&raster, BATCH_WIDTH, BATCH_HEIGHT) || !pen) {
+    rasterFree(&raster);
+    if (pen) {
+      penDestroy(pen);
+    }
+    return 0;
+  }
+
+  raster.smooth = batch->smooth;
+  raster.threads = batch->threads;
+  batchRaster = &raster;
+  penStream(pen, batchSink, &raster);
+  penSetBudget(pen, batch->fuel, batch->timeLimit);
+
+  while (1) {
+    int index = queuePop(&batch->queues[worker->id]);
+    for (int i = 1; index < 0 && i < batch->workers; i++) {
+      index = queueSteal(&batch->queues[(worker->id + i) % batch->workers]);
+    }
+
+    if (index < 0) {
+      break;
+    }
+
+    batchJob = &batch->jobs[index];
+    batchRun(batch, pen, batchJob);
+  }
+
+  batchRaster = 0;
+  penDestroy(pen);
+  rasterFree(&raster);
+  return 0;
+}
+
+int batchCompare(const void *a, const void *b) {
+  return strcmp(((Job *)a)->name, ((Job *)b)->name);
+}
+
+int batchList(Batch *batch) {
+  DIR *dir = opendir(batch->input);
+  if (!dir) {
+    fprintf(stderr, "ERROR: could not open directory '%s'\n", batch->input);
+    return -1;
+  }
+
+  int count = 0;
+  int cap = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    char path[4096];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", batch->input, entry->d_name);
+    if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+
+    if (count == cap) {
+      cap = cap ? cap * 2 : 64;
+      Job *jobs = realloc(batch->jobs, cap * sizeof(Job));
+      if (!jobs) {
+        closedir(dir);
+        return -1;
+      }
+      batch->jobs = jobs;
+    }
+
+    batch->jobs[count++] = (Job){.name = strdup(entry->d_name)};
+  }
+  closedir(dir);
+
+  qsort(batch->jobs, count, sizeof(Job), batchCompare);
+  return count;
+}
+
+int batchMain(char *input, char *output, int jobs, int smooth, long long fuel, int timeLimit) {
+  Batch batch = {
+      .input = input,
+      .output = output,
+      .smooth = smooth,
+      .fuel = fuel,
+      .timeLimit = timeLimit,
+  };
+  int count = batchList(&batch);
+  if (count < 0) {
+    return 1;
+  }
+
+  if (mkdir(output, 0755) && access(output, W_OK)) {
+    fprintf(stderr, "ERROR: could not create directory '%s'\n", output);
+    return 1;
+  }
+
+  int cores = sysconf(_SC_NPROCESSORS_ONLN);
+  batch.workers = jobs > 0 ? jobs : cores;
+  if (batch.workers > count) {
+    batch.workers = count;
+  }
+
+  if (batch.workers < 1) {
+    batch.workers = 1;
+  }
+
+  // Cores left over when there are fewer scripts than cores rasterize tiles
+  batch.threads = jobs > 0 ? 1 : cores / batch.workers;
+
+  batch.queues = calloc(batch.workers, sizeof(Queue));
+  Worker *workers = calloc(batch.workers, sizeof(Worker));
+  pthread_t *threads = calloc(batch.workers, sizeof(pthread_t));
+  if (!batch.queues || !workers || !threads) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return 1;
+  }
+
+  // Deal the scripts out in contiguous runs, stealing evens out the rest
+  for (int i = 0; i < batch.workers; i++) {
+    Queue *queue = &batch.queues[i];
+    int first = count * i / batch.workers;
+    int last = count * (i + 1) / batch.workers;
+
+    pthread_mutex_init(&queue->lock, 0);
+    queue->items = malloc((last - first + 1) * sizeof(int));
+    if (!queue->items) {
+      fprintf(stderr, "ERROR: out of memory\n");
+      return 1;
+    }
+
+    for (int j = first; j < last; j++) {
+      queue->items[queue->tail++] = j;
+    }
+  }
+
+  double start = jobNow();
+  int started = 0;
+  for (int i = 0; i < batch.workers; i++) {
+    workers[i] = (Worker){.batch = &batch, .id = i};
+  }
+
+  while (started < batch.workers &&
+         !pthread_create(&threads[started], 0, batchWorker, &workers[started])) {
+    started++;
+  }
+
+  // The workers that started steal the queues of those that did not, without
+  // any the calling thread takes them all
+  if (!started) {
+    batchWorker(&workers[0]);
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], 0);
+  }
+  double total = jobNow() - start;
+
+  int failed = 0;
+  int replayed = 0;
+  double compile = 0;
+  double run = 0;
+  double render = 0;
+  for (int i = 0; i < count; i++) {
+    Job *job = &batch.jobs[i];
+    if (job->ok) {
+      printf("%s: compile %.3fms, run %.3fms, render %.3fms\n", job->name, job->compile, job->run,
+             job->render);
+      compile += job->compile;
+      run += job->run;
+      render += job->render;
+      replayed += job->replayed;
+    } else {
+      printf("%s: ERROR: %s\n", job->name, job->error[0] ? job->error : "failed");
+      failed++;
+    }
+  }
+
+  printf("Rendered %d of %d scripts in %.3fms on %d threads\n", count - failed, count, total,
+         started ? started : 1);
+  printf("Total compile %.3fms, run %.3fms, render %.3fms\n", compile, run, render);
+  if (replayed) {
+    printf("Replayed %d repeated scripts without running them\n", replayed);
+  }
+
+  for (int i = 0; i < batch.workers; i++) {
+    pthread_mutex_destroy(&batch.queues[i].lock);
+    free(batch.queues[i].items);
+  }
+
+  for (int i = 0; i < count; i++) {
+    free(batch.jobs[i].name);
+  }
+
+  free(batch.jobs);
+  free(batch.queues);
+  free(workers);
+  free(threads);
+  return failed != 0;
+}
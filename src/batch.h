@@ -0,0 +1,14 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Renders every script in a directory to an image without opening a window.
+// Scripts are streamed into the image while they run, and the error hooks of
+// the thread running a script forward to these while batchActive() is true.
+// Every script gets the fuel and time limit of penSetBudget(), 0 for none.
+int batchMain(char *input, char *output, int jobs, int smooth, long long fuel, int timeLimit);
+
+int batchActive(void);
+void batchErrorStart(void);
+void batchErrorPush(char *data, int count);
+
+#endif
@@ -0,0 +1,320 @@
+#include "raster.h"
+#include "svg.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmarks the line rasterizer against the scalar reference, the SVG writer
+// against fprintf() and the interpreter, which takes the -DELANG_* flags of
+// build.sh for the other dispatch modes
+//   cc -O2 -ffp-contract=off -Isrc -o bench src/bench.c src/raster.c src/svg.c -lm -lpthread
+//   ./bench [threads]
+
+#define ELANG_IMPLEMENTATION
+#include "elang.h"
+
+#define BENCH_SIZE 2048
+#define BENCH_FRAMES 10
+#define BENCH_SVG_POINTS 1000000
+#define BENCH_SVG_CHUNK 7040
+#define BENCH_RUNS 10
+
+typedef struct {
+  char *name;
+  float *lines;
+  int count;
+} Scene;
+
+unsigned int benchSeed = 1;
+
+float benchRandom(void) {
+  benchSeed = benchSeed * 1103515245 + 12345;
+  return (benchSeed >> 8) / 16777216.0f;
+}
+
+double benchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// A turtle taking short steps and turning a little every time, like most scripts
+Scene sceneWalk(int count) {
+  Scene scene = {"walk", malloc(count * 4 * sizeof(float)), count};
+  float x = BENCH_SIZE / 2;
+  float y = BENCH_SIZE / 2;
+  float angle = 0;
+  for (int i = 0; i < count; i++) {
+    angle += benchRandom() - 0.5f;
+    float length = 4 + benchRandom() * 28;
+    float dx = cosf(angle) * length;
+    float dy = sinf(angle) * length;
+
+    // Turn around at the edges
+    if (x + dx < 0 || x + dx >= BENCH_SIZE || y + dy < 0 || y + dy >= BENCH_SIZE) {
+      angle += 3.14159265f;
+      dx = -dx;
+      dy = -dy;
+    }
+
+    float *line = &scene.lines[i * 4];
+    line[0] = (int)x;
+    line[1] = (int)y;
+    x += dx;
+    y += dy;
+    line[2] = (int)x;
+    line[3] = (int)y;
+  }
+  return scene;
+}
+
+// Long lines from one edge of the canvas to another
+Scene sceneWeb(int count) {
+  Scene scene = {"web", malloc(count * 4 * sizeof(float)), count};
+  for (int i = 0; i < count * 4; i++) {
+    scene.lines[i] = (int)(benchRandom() * BENCH_SIZE);
+  }
+  return scene;
+}
+
+// Long, nearly horizontal lines, like hatching, where the spans are widest
+Scene sceneHatch(int count) {
+  Scene scene = {"hatch", malloc(count * 4 * sizeof(float)), count};
+  for (int i = 0; i < count; i++) {
+    float *line = &scene.lines[i * 4];
+    line[0] = (int)(benchRandom() * BENCH_SIZE / 4);
+    line[1] = (int)(benchRandom() * BENCH_SIZE);
+    line[2] = BENCH_SIZE - 1 - line[0];
+    line[3] = line[1] + (int)((benchRandom() - 0.5f) * BENCH_SIZE / 16);
+  }
+  return scene;
+}
+
+double benchReference(Raster *raster, Scene *scene) {
+  double start = benchNow();
+  for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+    rasterClear(raster);
+    for (int i = 0; i < scene->count; i++) {
+      float *line = &scene->lines[i * 4];
+      rasterDrawLineReference(raster, line[0], line[1], line[2], line[3]);
+    }
+  }
+  return (benchNow() - start) / BENCH_FRAMES;
+}
+
+double benchRaster(Raster *raster, Scene *scene) {
+  double start = benchNow();
+  for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+    rasterClear(raster);
+    for (int i = 0; i < scene->count; i++) {
+      float *line = &scene->lines[i * 4];
+      rasterPushLine(raster, line[0], line[1], line[2], line[3]);
+    }
+    rasterFlush(raster);
+  }
+  return (benchNow() - start) / BENCH_FRAMES;
+}
+
+int benchScene(Scene *scene, int threads) {
+  static char *kernels[] = {"scalar", "sse2", "avx2"};
+  int size = BENCH_SIZE * BENCH_SIZE;
+
+  Raster raster;
+  unsigned char *expected = malloc(size);
+  if (!rasterInit(&raster, BENCH_SIZE, BENCH_SIZE) || !expected) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return 0;
+  }
+
+  printf("%s: %d lines on %dx%d\n", scene->name, scene->count, BENCH_SIZE, BENCH_SIZE);
+  printf("  %-24s %8.3fms\n", "reference", benchReference(&raster, scene));
+
+  // The scalar kernel on one thread is what the rest is checked against
+  int ok = 1;
+  for (int smooth = 0; smooth <= 1; smooth++) {
+    raster.smooth = smooth;
+    for (int kernel = RASTER_SCALAR; kernel <= RASTER_AVX2; kernel++) {
+      if (!rasterSupports(kernel) || (!smooth && kernel != RASTER_SCALAR)) {
+        continue;
+      }
+
+      for (int t = 1; t <= threads; t = t < threads && t * 2 > threads ? threads : t * 2) {
+        raster.kernel = kernel;
+        raster.threads = t;
+        double time = benchRaster(&raster, scene);
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s%s, %d thread%s", smooth ? "smooth " : "",
+                 kernels[kernel], t, t == 1 ? "" : "s");
+        printf("  %-24s %8.3fms", label, time);
+
+        if (kernel == RASTER_SCALAR && t == 1) {
+          memcpy(expected, raster.pixels, size);
+        } else if (memcmp(expected, raster.pixels, size)) {
+          printf("  MISMATCH");
+          ok = 0;
+        }
+        printf("\n");
+      }
+    }
+  }
+
+  rasterFree(&raster);
+  free(expected);
+  return ok;
+}
+
+// The same path data as the SVG writer, formatted by fprintf()
+void benchSvgPrintf(FILE *file, float *xs, float *ys, int count) {
+  fprintf(file, "M%.2f %.2fl", xs[0], ys[0]);
+  for (int i = 1; i < count; i++) {
+    fprintf(file, "%.2f %.2f ", xs[i] - xs[i - 1], ys[i] - ys[i - 1]);
+  }
+}
+
+int benchSvg(void) {
+  float *xs = malloc(BENCH_SVG_POINTS * sizeof(float));
+  float *ys = malloc(BENCH_SVG_POINTS * sizeof(float));
+  Svg *svg = malloc(sizeof(Svg));
+  if (!xs || !ys || !svg) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return 0;
+  }
+
+  // A walk like sceneWalk(), handed over in chunks like the canvas does
+  float x = 0;
+  float y = 0;
+  float angle = 0;
+  for (int i = 0; i < BENCH_SVG_POINTS; i++) {
+    angle += benchRandom() - 0.5f;
+    x += cosf(angle) * (4 + benchRandom() * 28);
+    y += sinf(angle) * (4 + benchRandom() * 28);
+    xs[i] = x;
+    ys[i] = y;
+  }
+
+  printf("svg: %d segments to /dev/null\n", BENCH_SVG_POINTS - 1);
+  double start = benchNow();
+  if (!svgOpen(svg, "/dev/null")) {
+    fprintf(stderr, "ERROR: could not open /dev/null\n");
+    return 0;
+  }
+
+  for (int i = 0; i < BENCH_SVG_POINTS; i += BENCH_SVG_CHUNK - 1) {
+    int count = BENCH_SVG_POINTS - i < BENCH_SVG_CHUNK ? BENCH_SVG_POINTS - i : BENCH_SVG_CHUNK;
+    svgPoints(svg, &xs[i], &ys[i], count);
+  }
+  int ok = svgClose(svg);
+  double time = benchNow() - start;
+  printf("  %-24s %8.3fms %8.1fM segments/s\n", "writer", time, BENCH_SVG_POINTS / time / 1e3);
+
+  start = benchNow();
+  FILE *file = fopen("/dev/null", "wb");
+  if (file) {
+    for (int i = 0; i < BENCH_SVG_POINTS; i += BENCH_SVG_CHUNK - 1) {
+      int count = BENCH_SVG_POINTS - i < BENCH_SVG_CHUNK ? BENCH_SVG_POINTS - i : BENCH_SVG_CHUNK;
+      benchSvgPrintf(file, &xs[i], &ys[i], count);
+    }
+    fclose(file);
+  }
+  time = benchNow() - start;
+  printf("  %-24s %8.3fms %8.1fM segments/s\n", "fprintf", time, BENCH_SVG_POINTS / time / 1e3);
+
+  free(xs);
+  free(ys);
+  free(svg);
+  return ok;
+}
+
+// Dispatch
+void platformErrorStart(void) {
+  fprintf(stderr, "ERROR: ");
+}
+
+void platformErrorPush(char *data, int count) {
+  fwrite(data, 1, count, stderr);
+}
+
+void platformErrorEnd(void) {
+  fprintf(stderr, "\n");
+}
+
+void *benchAlloc(void *context, int size) {
+  return malloc(size);
+}
+
+void benchFree(void *context, void *data) {
+  free(data);
+}
+
+float benchAdd(ElangVM *vm, float *args) {
+  return args[0] + args[1];
+}
+
+typedef struct {
+  char *name;
+  char *source;
+} Script;
+
+// Global arithmetic, calls and a loop over locals calling a native
+Script scripts[] = {
+  {"loop", "i = 0 s = 0 while i < 1000000 { s = s + i * 2 - 1 i = i + 1 }"},
+  {"calls", "fn fib(n) { if n < 2 { return n } return fib(n - 1) + fib(n - 2) } fib(22)"},
+  {"natives", "fn sum(n) { i = 0 s = 0 while i < n { s = add(s, i) i = i + 1 } return s } "
+              "sum(1000000)"},
+};
+
+int benchDispatch(void) {
+  ElangVM *vm = elangVMCreate((ElangAllocator){.alloc = benchAlloc, .free = benchFree}, 0);
+  if (!vm || !elangVMRegisterNative(vm, "add", 2, benchAdd)) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return 0;
+  }
+
+  printf("dispatch: %d bytes per op\n", (int)sizeof(Op));
+  int ok = 1;
+  for (int i = 0; i < (int)(sizeof(scripts) / sizeof(*scripts)); i++) {
+    Script *script = &scripts[i];
+    if (!elangVMCompile(vm, script->source, strlen(script->source))) {
+      ok = 0;
+      continue;
+    }
+
+    double start = benchNow();
+    for (int j = 0; j < BENCH_RUNS; j++) {
+      ok = elangVMRun(vm) && ok;
+    }
+    double time = (benchNow() - start) / BENCH_RUNS;
+    printf("  %-24s %8.3fms", script->name, time);
+
+#ifdef ELANG_COUNT
+    // Counting adds to every dispatch, the time above is with it
+    printf(" %8.1fM ops/s", elangVMDispatched(vm) / time / 1e3);
+#endif
+    printf("\n");
+  }
+
+  elangVMDestroy(vm);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  Scene scenes[] = {sceneWalk(50000), sceneWeb(2000), sceneHatch(2000)};
+  int ok = 1;
+  for (int i = 0; i < (int)(sizeof(scenes) / sizeof(*scenes)); i++) {
+    ok = benchScene(&scenes[i], threads) && ok;
+    free(scenes[i].lines);
+  }
+
+  ok = benchSvg() && ok;
+  ok = benchDispatch() && ok;
+  return !ok;
+}
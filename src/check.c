@@ -0,0 +1,82 @@
+#include "elang.h"
+#include "pen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks a script compiled with `pen --emit-c` against the interpreter
+//   cc -O2 -Isrc -o check src/check.c src/pen.c script.c && ./check
+
+float *pointsXs;
+float *pointsYs;
+int *pointsStarts;
+
+void platformClear(void) {}
+
+void platformErrorStart(void) {
+  fprintf(stderr, "ERROR: ");
+}
+
+void platformErrorPush(char *data, int count) {
+  fwrite(data, count, 1, stderr);
+}
+
+void platformErrorEnd(void) {
+  fputc('\n', stderr);
+}
+
+void platformDrawLines(float *points, int count) {}
+
+int main(void) {
+  penInit();
+  penUpdate(elangSource, strlen(elangSource));
+
+  int count = 0;
+  for (int cap = 0;; count++) {
+    if (count == cap) {
+      cap = cap ? cap * 2 : 1024;
+      pointsXs = realloc(pointsXs, cap * sizeof(float));
+      pointsYs = realloc(pointsYs, cap * sizeof(float));
+      pointsStarts = realloc(pointsStarts, cap * sizeof(int));
+      if (!pointsXs || !pointsYs || !pointsStarts) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+      }
+    }
+
+    if (!penPoint(count, &pointsXs[count], &pointsYs[count], &pointsStarts[count])) {
+      break;
+    }
+  }
+
+  penUpdateProgram(elangProgram);
+
+  float x, y;
+  int start;
+  for (int i = 0; i < count; i++) {
+    if (!penPoint(i, &x, &y, &start)) {
+      fprintf(stderr, "ERROR: compiled canvas has %d points, expected %d\n", i, count);
+      return 1;
+    }
+
+    if (memcmp(&x, &pointsXs[i], sizeof(x)) || memcmp(&y, &pointsYs[i], sizeof(y))) {
+      fprintf(stderr, "ERROR: point %d is (%g, %g), expected (%g, %g)\n", i, x, y, pointsXs[i],
+              pointsYs[i]);
+      return 1;
+    }
+
+    if (start != pointsStarts[i]) {
+      fprintf(stderr, "ERROR: point %d %s a stroke, expected it to %s one\n", i,
+              start ? "starts" : "continues", start ? "continue" : "start");
+      return 1;
+    }
+  }
+
+  if (penPoint(count, &x, &y, &start)) {
+    fprintf(stderr, "ERROR: compiled canvas has more than %d points\n", count);
+    return 1;
+  }
+
+  printf("%d points match\n", count);
+  return 0;
+}
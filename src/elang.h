@@ -25,11 +25,100 @@ void platformErrorStart(void);
 void platformErrorPush(char *data, int count);
 void platformErrorEnd(void);
 
-typedef float (*Native)(float *);
+// An ElangVM holds a compiled program with everything it allocated, separate
+// VMs can be used from separate threads. The functions without a VM argument
+// work on a default VM.
+typedef struct ElangVM ElangVM;
+
+// Natives read their arguments from args and must not write to them
+typedef float (*Native)(ElangVM *vm, float *args);
+
+typedef struct {
+  void *(*alloc)(void *context, int size);
+  void (*free)(void *context, void *data);
+  void *context;
+} ElangAllocator;
+
+#ifndef ELANG_MEMORY_LIMIT
+#define ELANG_MEMORY_LIMIT (16 * 1024 * 1024)
+#endif
+
+#ifndef ELANG_STACK_LIMIT
+#define ELANG_STACK_LIMIT (64 * 1024)
+#endif
+
+ElangVM *elangVMCreate(ElangAllocator allocator, void *user);
+void elangVMDestroy(ElangVM *vm);
+void *elangVMUser(ElangVM *vm);
+void elangVMSetUser(ElangVM *vm, void *user);
+
+int elangVMRun(ElangVM *vm);
+int elangVMCompile(ElangVM *vm, char *data, int size);
+int elangVMRegisterNative(ElangVM *vm, char *name, int arity, Native native);
+Native elangVMNative(ElangVM *vm, int index);
+
+// Hashes a program with the natives and limits it would run with, programs
+// with the same hash do the same when run
+unsigned long long elangVMHash(ElangVM *vm, char *data, int size);
+
+// Bytecode saved by elangVMSaveBytecode() loads into any VM with the same
+// natives without compiling again. Its ops are run in place, so it has to stay
+// unchanged until the next compilation. Loading checks that the bytecode is
+// whole, fits the VM, and keeps the stack and every jump within the function it
+// belongs to, so bytecode from anywhere can only fail with an error.
+typedef void (*ElangWrite)(void *context, void *data, int size);
+
+int elangVMSaveBytecode(ElangVM *vm, char *data, int size, ElangWrite write, void *context);
+int elangVMLoadBytecode(ElangVM *vm, void *data, int size);
+int elangIsBytecode(void *data, int size);
+
+void elangVMSetMemoryLimit(ElangVM *vm, int bytes);
+void elangVMSetStackLimit(ElangVM *vm, int slots);
+int elangVMMemoryUsed(ElangVM *vm);
+
+// A run fails once it has taken more than fuel steps, every call and every jump
+// back to the start of a loop being one step, or once clock has gone past
+// milliseconds since it started. The clock returns milliseconds and is only
+// read every few thousand steps. Zero means no limit, which is the default.
+typedef double (*ElangClock)(void *context);
+
+void elangVMSetFuel(ElangVM *vm, long long fuel);
+void elangVMSetTimeLimit(ElangVM *vm, int milliseconds, ElangClock clock, void *context);
+
+// Fails the run from a native, which reports the error itself. The script stops
+// at its next step, or at its end.
+void elangVMFail(ElangVM *vm);
+
+ElangVM *elangDefault(void);
 
 int elangRun(void);
 int elangCompile(char *data, int size);
 int elangRegisterNative(char *name, int arity, Native native);
+unsigned long long elangHash(char *data, int size);
+int elangSaveBytecode(char *data, int size, ElangWrite write, void *context);
+int elangLoadBytecode(void *data, int size);
+
+void elangSetAllocator(ElangAllocator allocator);
+void elangSetMemoryLimit(int bytes);
+void elangSetStackLimit(int slots);
+int elangMemoryUsed(void);
+void elangSetFuel(long long fuel);
+void elangSetTimeLimit(int milliseconds, ElangClock clock, void *context);
+
+#ifdef ELANG_COUNT
+unsigned long elangVMDispatched(ElangVM *vm);
+#endif
+
+#ifdef ELANG_AOT
+#include <stdio.h>
+
+int elangVMEmitC(ElangVM *vm, char *data, int size, FILE *file);
+int elangEmitC(char *data, int size, FILE *file);
+#endif
+
+// Defined by the C code elangEmitC() generates
+int elangProgram(ElangVM *vm);
+extern char elangSource[];
 
 #endif
 
@@ -57,6 +146,30 @@ int strEq(Str a, Str b) {
   return 1;
 }
 
+unsigned int strHash(Str s) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < s.count; i++) {
+    hash = (hash ^ (unsigned char)s.data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// A 64-bit FNV-1a that continues from hash, for keys that must not collide
+#define HASH_BASIS 14695981039346656037ull
+#define HASH_PRIME 1099511628211ull
+
+unsigned long long strHashFrom(Str s, unsigned long long hash) {
+  for (int i = 0; i < s.count; i++) {
+    hash = (hash ^ (unsigned char)s.data[i]) * HASH_PRIME;
+  }
+  return hash;
+}
+
+// Values past 255 never stand for a byte, so they also separate strings
+unsigned long long hashMix(unsigned long long hash, unsigned int value) {
+  return (hash ^ value) * HASH_PRIME;
+}
+
 Str strFromInt(int n, char *buffer) {
   int size = 0;
   if (n) {
@@ -243,6 +356,338 @@ typedef struct {
   Str str;
 } Token;
 
+// Op
+typedef enum {
+  OP_NUM,
+
+  OP_GT,
+  OP_GE,
+  OP_LT,
+  OP_LE,
+  OP_EQ,
+  OP_NE,
+
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+
+  OP_NOT,
+  OP_NEG,
+
+  OP_ELSE,
+  OP_GOTO,
+  OP_CALL,
+  OP_NATIVE,
+  OP_RETURN,
+
+  OP_DROP,
+  OP_GETG,
+  OP_SETG,
+  OP_GETL,
+  OP_SETL,
+
+  OP_GT_ELSE,
+  OP_GE_ELSE,
+  OP_LT_ELSE,
+  OP_LE_ELSE,
+  OP_EQ_ELSE,
+  OP_NE_ELSE,
+
+  OP_GTK_ELSE,
+  OP_GEK_ELSE,
+  OP_LTK_ELSE,
+  OP_LEK_ELSE,
+  OP_EQK_ELSE,
+  OP_NEK_ELSE,
+
+  OP_INCL,
+  OP_INCG,
+  OP_NATIVEL
+} OpType;
+
+// Ops are four bytes, the operand is an index. Jumps index the ops, OP_NUM
+// indexes the constants. A program has at most as many ops as the largest
+// operand, so jumps past its last op fit too.
+#define OPS_LIMIT ((1 << 24) - 1)
+
+typedef struct {
+  unsigned int type : 8;
+  unsigned int data : 24;
+} Op;
+
+// Arena
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk ArenaChunk;
+
+struct ArenaChunk {
+  ArenaChunk *next;
+  int size;
+  int used;
+};
+
+#define ARENA_HEADER ((int)(sizeof(ArenaChunk) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+typedef struct {
+  ArenaChunk *chunk;
+  int used;
+  int total;
+} ArenaMark;
+
+// Symbol
+typedef struct {
+  Str name;
+  int function;
+  int variable;
+} Symbol;
+
+// Program
+// The context of an entry hashes its name and those of every entry before it
+typedef struct {
+  Str name;
+  int symbol;
+  int body;
+  int arity;
+  int start;
+  int depth;
+  unsigned long long context;
+} Function;
+
+typedef struct {
+  Str name;
+  int symbol;
+  float data;
+  unsigned long long context;
+} Variable;
+
+// Cache
+typedef struct {
+  unsigned long long hash;
+  unsigned int name;
+  int length;
+  int rows;
+  int arity;
+  int body;
+  int depth;
+  int start;
+  int ops;
+  int count;
+} CacheEntry;
+
+typedef struct {
+  CacheEntry *entries;
+  int entriesCount;
+  int entriesCap;
+  Op *ops;
+  int opsCount;
+  int opsCap;
+  float *consts;
+  int constsCount;
+  int constsCap;
+} Cache;
+
+#if defined(ELANG_THREADED) && defined(__GNUC__) && !defined(__wasm32__)
+#define ELANG_COMPUTED_GOTO
+#endif
+
+#ifdef ELANG_REGISTER
+// Register
+typedef enum {
+  REG_MOV,
+
+  REG_GT,
+  REG_GE,
+  REG_LT,
+  REG_LE,
+  REG_EQ,
+  REG_NE,
+  REG_ADD,
+  REG_SUB,
+  REG_MUL,
+  REG_DIV,
+
+  REG_GTK,
+  REG_GEK,
+  REG_LTK,
+  REG_LEK,
+  REG_EQK,
+  REG_NEK,
+  REG_ADDK,
+  REG_SUBK,
+  REG_MULK,
+  REG_DIVK,
+
+  REG_NOT,
+  REG_NEG,
+
+  REG_ELSE,
+  REG_GT_ELSE,
+  REG_GE_ELSE,
+  REG_LT_ELSE,
+  REG_LE_ELSE,
+  REG_EQ_ELSE,
+  REG_NE_ELSE,
+  REG_GTK_ELSE,
+  REG_GEK_ELSE,
+  REG_LTK_ELSE,
+  REG_LEK_ELSE,
+  REG_EQK_ELSE,
+  REG_NEK_ELSE,
+
+  REG_GOTO,
+  REG_CALL,
+  REG_NATIVE,
+  REG_RETURN
+} RegType;
+
+// Operands >= 0 are frame slots, operands < 0 index regsPool, which holds the
+// globals followed by the constants. The compares fused with a branch jump to
+// dst, natives take their arguments from b.
+typedef struct {
+  RegType type;
+  int dst;
+  int a;
+  union {
+    int b;
+    float k;
+  };
+} Reg;
+#endif
+
+#if defined(ELANG_JIT) && defined(__x86_64__) && defined(__unix__)
+#define ELANG_JIT_X86_64
+#endif
+
+#ifdef ELANG_JIT_X86_64
+// Jit
+typedef struct {
+  int at;
+  int target;
+  int entry;
+} JitPatch;
+#endif
+
+// VM
+struct ElangVM {
+  void *user;
+
+  Str lexerStr;
+  Token lexerToken;
+  int lexerRow;
+  int lexerBuffer;
+
+  ElangAllocator arenaAllocator;
+  ArenaChunk *arenaHead;
+  ArenaChunk *arenaChunk;
+  ArenaMark arenaMark;
+  int arenaTotal;
+  int arenaLimit;
+
+  Symbol *symbols;
+  int symbolsCount;
+  int symbolsCap;
+  int *symbolsTable;
+  int symbolsTableCap;
+
+  Function *functions;
+  int functionsCount;
+  int functionsCap;
+  int functionsLocal;
+
+  // Natives are kept across compilations at the start of the table
+  Function *functionsKept;
+  int functionsKeptCap;
+
+  Op *ops;
+  int opsCount;
+  int opsCap;
+  int opsDepth;
+  int opsDepthMax;
+  int *opsMap;
+  char *opsTarget;
+  char *opsLive;
+  int *opsWork;
+  Op *opsFused;
+
+  float *consts;
+  int constsCount;
+  int constsCap;
+
+  Variable *variables;
+  int variablesCap;
+  int variablesMax;
+  int variablesBase;
+  int variablesCount;
+
+  Native *natives;
+  int nativesCount;
+  int nativesCap;
+
+  // Functions of the last compilation and those of the one in progress
+  Cache cache;
+  Cache cacheNext;
+
+  float *stack;
+  float *stackEnd;
+  int stackCap;
+  int stackLimit;
+
+  // Steps left before the fuel and the clock are checked, out of budgetArmed
+  int budgetSteps;
+  int budgetArmed;
+  long long budgetFuel;
+  long long budgetFuelLeft;
+  int budgetTime;
+  double budgetDeadline;
+  ElangClock budgetClock;
+  void *budgetClockContext;
+  int budgetFailed;
+
+#ifdef ELANG_COUNT
+  unsigned long dispatched;
+#endif
+
+#ifdef ELANG_COMPUTED_GOTO
+  void **opsLabels;
+  int opsResolved;
+#endif
+
+#ifdef ELANG_REGISTER
+  Reg *regs;
+  int regsCount;
+  int regsCap;
+  int *regsAddr;
+  int *regsValues;
+  float *regsPool;
+  int regsPoolCount;
+  int regsPoolCap;
+  int regsGlobals;
+#endif
+
+#ifdef ELANG_JIT_X86_64
+  unsigned char *jitCode;
+  int jitCodeCap;
+  int jitSize;
+  int jitReady;
+  int jitFailed;
+  int *jitAddr;
+  int *jitEntry;
+  JitPatch *jitPatches;
+  int jitPatchesCount;
+  int jitPatchesCap;
+  int jitGrowAt;
+  int jitBudgetAt;
+  int jitOverflowAt;
+  void *jitRsp;
+#endif
+
+#ifdef ELANG_AOT
+  char *aotTarget;
+#endif
+};
+
 // Lexer
 int isdigit(int ch) {
   return ch >= '0' && ch <= '9';
@@ -256,36 +701,31 @@ int isident(int ch) {
   return ch == '_' || isalpha(ch);
 }
 
-int lexerRow;
-Str lexerStr;
-int lexerBuffer;
-Token lexerToken;
-
-void lexerInit(Str str) {
-  lexerRow = 1;
-  lexerStr = str;
-  lexerBuffer = 0;
+void lexerInit(ElangVM *vm, Str str) {
+  vm->lexerRow = 1;
+  vm->lexerStr = str;
+  vm->lexerBuffer = 0;
 }
 
-void lexerRead() {
-  if (*lexerStr.data == '\n') {
-    lexerRow++;
+void lexerRead(ElangVM *vm) {
+  if (*vm->lexerStr.data == '\n') {
+    vm->lexerRow++;
   }
-  lexerStr.data++;
-  lexerStr.count--;
+  vm->lexerStr.data++;
+  vm->lexerStr.count--;
 }
 
-void lexerTrim() {
-  while (lexerStr.count) {
-    switch (*lexerStr.data) {
+void lexerTrim(ElangVM *vm) {
+  while (vm->lexerStr.count) {
+    switch (*vm->lexerStr.data) {
     case ' ':
     case '\n':
-      lexerRead();
+      lexerRead(vm);
       break;
 
     case '#':
-      while (lexerStr.count && *lexerStr.data != '\n') {
-        lexerRead();
+      while (vm->lexerStr.count && *vm->lexerStr.data != '\n') {
+        lexerRead(vm);
       }
       break;
 
@@ -295,115 +735,115 @@ void lexerTrim() {
   }
 }
 
-int lexerMatch(char ch) {
-  if (lexerStr.count && *lexerStr.data == ch) {
-    lexerRead();
+int lexerMatch(ElangVM *vm, char ch) {
+  if (vm->lexerStr.count && *vm->lexerStr.data == ch) {
+    lexerRead(vm);
     return 1;
   }
 
   return 0;
 }
 
-int lexerNext(Token *token) {
-  if (lexerBuffer) {
-    lexerBuffer = 0;
-    *token = lexerToken;
+int lexerNext(ElangVM *vm, Token *token) {
+  if (vm->lexerBuffer) {
+    vm->lexerBuffer = 0;
+    *token = vm->lexerToken;
     return 1;
   }
 
-  lexerTrim();
+  lexerTrim(vm);
 
-  token->row = lexerRow;
-  token->str = lexerStr;
+  token->row = vm->lexerRow;
+  token->str = vm->lexerStr;
 
-  if (!lexerStr.count) {
+  if (!vm->lexerStr.count) {
     token->type = TOKEN_EOF;
     return 1;
   }
 
-  switch (*lexerStr.data) {
+  switch (*vm->lexerStr.data) {
   case '!':
-    lexerRead();
-    token->type = lexerMatch('=') ? TOKEN_NE : TOKEN_NOT;
+    lexerRead(vm);
+    token->type = lexerMatch(vm, '=') ? TOKEN_NE : TOKEN_NOT;
     break;
 
   case '>':
-    lexerRead();
-    token->type = lexerMatch('=') ? TOKEN_GE : TOKEN_GT;
+    lexerRead(vm);
+    token->type = lexerMatch(vm, '=') ? TOKEN_GE : TOKEN_GT;
     break;
 
   case '<':
-    lexerRead();
-    token->type = lexerMatch('=') ? TOKEN_LE : TOKEN_LT;
+    lexerRead(vm);
+    token->type = lexerMatch(vm, '=') ? TOKEN_LE : TOKEN_LT;
     break;
 
   case '+':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_ADD;
     break;
 
   case '-':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_SUB;
     break;
 
   case '*':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_MUL;
     break;
 
   case '/':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_DIV;
     break;
 
   case '=':
-    lexerRead();
-    token->type = lexerMatch('=') ? TOKEN_EQ : TOKEN_SET;
+    lexerRead(vm);
+    token->type = lexerMatch(vm, '=') ? TOKEN_EQ : TOKEN_SET;
     break;
 
   case ',':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_COMMA;
     break;
 
   case '(':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_LPAREN;
     break;
 
   case ')':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_RPAREN;
     break;
 
   case '{':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_LBRACE;
     break;
 
   case '}':
-    lexerRead();
+    lexerRead(vm);
     token->type = TOKEN_RBRACE;
     break;
 
   default:
-    if (isdigit(*lexerStr.data)) {
-      while (lexerStr.count && isdigit(*lexerStr.data)) {
-        lexerRead();
+    if (isdigit(*vm->lexerStr.data)) {
+      while (vm->lexerStr.count && isdigit(*vm->lexerStr.data)) {
+        lexerRead(vm);
       }
 
-      if (lexerStr.count && *lexerStr.data == '.') {
-        lexerRead();
-        while (lexerStr.count && isdigit(*lexerStr.data)) {
-          lexerRead();
+      if (vm->lexerStr.count && *vm->lexerStr.data == '.') {
+        lexerRead(vm);
+        while (vm->lexerStr.count && isdigit(*vm->lexerStr.data)) {
+          lexerRead(vm);
         }
       }
 
       token->type = TOKEN_NUM;
-    } else if (isident(*lexerStr.data)) {
-      while (lexerStr.count && isident(*lexerStr.data)) {
-        lexerRead();
+    } else if (isident(*vm->lexerStr.data)) {
+      while (vm->lexerStr.count && isident(*vm->lexerStr.data)) {
+        lexerRead(vm);
       }
 
       token->type = TOKEN_IDENT;
@@ -414,7 +854,7 @@ int lexerNext(Token *token) {
     }
   }
 
-  token->str.count -= lexerStr.count;
+  token->str.count -= vm->lexerStr.count;
 
   if (token->type == TOKEN_IDENT) {
     if (strEq(token->str, STR("if"))) {
@@ -433,20 +873,20 @@ int lexerNext(Token *token) {
   return 1;
 }
 
-int lexerPeek(Token *token) {
-  if (!lexerBuffer) {
-    if (!lexerNext(&lexerToken)) {
+int lexerPeek(ElangVM *vm, Token *token) {
+  if (!vm->lexerBuffer) {
+    if (!lexerNext(vm, &vm->lexerToken)) {
       return 0;
     }
-    lexerBuffer = 1;
+    vm->lexerBuffer = 1;
   }
 
-  *token = lexerToken;
+  *token = vm->lexerToken;
   return 1;
 }
 
-int lexerNextExpect(Token *token, TokenType type) {
-  if (!lexerNext(token)) {
+int lexerNextExpect(ElangVM *vm, Token *token, TokenType type) {
+  if (!lexerNext(vm, token)) {
     return 0;
   }
 
@@ -459,185 +899,674 @@ int lexerNextExpect(Token *token, TokenType type) {
   return 1;
 }
 
-int lexerPeekExpect(TokenType type) {
-  if (!lexerNextExpect(&lexerToken, type)) {
+int lexerPeekExpect(ElangVM *vm, TokenType type) {
+  if (!lexerNextExpect(vm, &vm->lexerToken, type)) {
     return 0;
   }
 
-  lexerBuffer = 1;
+  vm->lexerBuffer = 1;
   return 1;
 }
 
-// Op
-typedef enum {
-  OP_NUM,
+// Arena
+// Everything a compiled program needs is bump allocated from chunks obtained
+// through the allocator. Compiling a program rewinds the arena to the mark left
+// by the last native registration, and tables that outgrow their storage are
+// copied to a bigger block, leaving the old one until the next rewind.
+ArenaChunk *arenaChunkNew(ElangVM *vm, int size) {
+  if (size < ARENA_CHUNK) {
+    size = ARENA_CHUNK;
+  }
 
-  OP_GT,
-  OP_GE,
-  OP_LT,
-  OP_LE,
-  OP_EQ,
-  OP_NE,
+  if (!vm->arenaAllocator.alloc) {
+    return 0;
+  }
 
-  OP_ADD,
-  OP_SUB,
-  OP_MUL,
-  OP_DIV,
+  ArenaChunk *chunk = vm->arenaAllocator.alloc(vm->arenaAllocator.context, ARENA_HEADER + size);
+  if (chunk) {
+    *chunk = (ArenaChunk){.size = size};
+  }
+  return chunk;
+}
 
-  OP_NOT,
-  OP_NEG,
+void *arenaAlloc(ElangVM *vm, int size) {
+  size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if (size < 0 || vm->arenaTotal - vm->arenaMark.total > vm->arenaLimit - size) {
+    LOG_ERROR(STR("Out of memory"));
+    return 0;
+  }
 
-  OP_ELSE,
-  OP_GOTO,
-  OP_CALL,
-  OP_NATIVE,
-  OP_RETURN,
+  ArenaChunk **link = vm->arenaChunk ? &vm->arenaChunk->next : &vm->arenaHead;
+  if (!vm->arenaChunk || vm->arenaChunk->size - vm->arenaChunk->used < size) {
+    ArenaChunk *chunk = *link;
+    if (chunk && chunk->size < size) {
+      ArenaChunk *next = chunk->next;
+      if (vm->arenaAllocator.free) {
+        vm->arenaAllocator.free(vm->arenaAllocator.context, chunk);
+      }
+      chunk = 0;
+      *link = next;
+    }
 
-  OP_DROP,
-  OP_GETG,
-  OP_SETG,
-  OP_GETL,
-  OP_SETL
-} OpType;
+    if (!chunk) {
+      chunk = arenaChunkNew(vm, size);
+      if (!chunk) {
+        LOG_ERROR(STR("Out of memory"));
+        return 0;
+      }
 
-typedef struct {
-  OpType type;
-  float data;
-} Op;
+      chunk->next = *link;
+      *link = chunk;
+    }
 
-// Program
-typedef float (*Native)(float *);
+    chunk->used = 0;
+    vm->arenaChunk = chunk;
+  }
 
-typedef struct {
-  Str name;
-  int body;
-  int arity;
-  int start;
-} Function;
+  void *data = (char *)vm->arenaChunk + ARENA_HEADER + vm->arenaChunk->used;
+  vm->arenaChunk->used += size;
+  vm->arenaTotal += size;
+  return data;
+}
 
-typedef struct {
-  Str name;
-  float data;
-} Variable;
+void arenaRewind(ElangVM *vm) {
+  vm->arenaChunk = vm->arenaMark.chunk;
+  vm->arenaTotal = vm->arenaMark.total;
+  if (vm->arenaChunk) {
+    vm->arenaChunk->used = vm->arenaMark.used;
+  }
+}
+
+void arenaKeep(ElangVM *vm) {
+  vm->arenaMark = (ArenaMark){
+    .chunk = vm->arenaChunk,
+    .used = vm->arenaChunk ? vm->arenaChunk->used : 0,
+    .total = vm->arenaTotal,
+  };
+}
+
+// Gives every chunk back to the allocator
+void arenaFree(ElangVM *vm) {
+  ArenaChunk *chunk = vm->arenaHead;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    if (vm->arenaAllocator.free) {
+      vm->arenaAllocator.free(vm->arenaAllocator.context, chunk);
+    }
+    chunk = next;
+  }
+
+  vm->arenaHead = 0;
+  vm->arenaChunk = 0;
+  vm->arenaTotal = 0;
+  vm->arenaMark = (ArenaMark){0};
+}
 
-#define PROGRAM_CAP 1024
+// Makes room for index count in a table of the given element size
+int arenaGrow(ElangVM *vm, void **data, int *cap, int size, int count) {
+  if (count < *cap) {
+    return 1;
+  }
 
-Op ops[PROGRAM_CAP];
-int opsCount;
+  int next = *cap ? *cap * 2 : 64;
+  while (next <= count) {
+    next *= 2;
+  }
 
-int opsPush(OpType type, float data) {
-  if (opsCount >= PROGRAM_CAP) {
-    LOG_ERROR(STR("Program overflow"));
+  char *copy = arenaAlloc(vm, next * size);
+  if (!copy) {
     return 0;
   }
 
-  ops[opsCount++] = (Op){.type = type, .data = data};
+  char *old = *data;
+  for (int i = 0; i < *cap * size; i++) {
+    copy[i] = old[i];
+  }
+
+  *data = copy;
+  *cap = next;
   return 1;
 }
 
-Function functions[PROGRAM_CAP];
-int functionsCount;
-int functionsLocal;
+#define ARENA_GROW(data, cap, count) arenaGrow(vm, (void **)&(data), &(cap), sizeof(*(data)), count)
+#define ARENA_ARRAY(type, count) ((type *)arenaAlloc(vm, (count) * (int)sizeof(type)))
 
-int functionsPush(Str name, int arity, int start) {
-  if (functionsCount >= PROGRAM_CAP) {
-    LOG_ERROR(STR("Functions overflow"));
+// Symbol
+// Every identifier is interned once per compilation. A symbol points to the
+// earliest function and variable bound to it, which may have gone out of scope
+// since, so the binding is checked against the table it points into.
+int symbolsInit(ElangVM *vm, int cap) {
+  vm->symbolsTable = ARENA_ARRAY(int, cap);
+  if (!vm->symbolsTable) {
     return 0;
   }
+  vm->symbolsTableCap = cap;
 
-  functions[functionsCount++] = (Function){
-    .name = name,
-    .arity = arity,
-    .start = start,
-  };
+  for (int i = 0; i < cap; i++) {
+    vm->symbolsTable[i] = -1;
+  }
+
+  for (int i = 0; i < vm->symbolsCount; i++) {
+    unsigned int j = strHash(vm->symbols[i].name) & (cap - 1);
+    while (vm->symbolsTable[j] >= 0) {
+      j = (j + 1) & (cap - 1);
+    }
+    vm->symbolsTable[j] = i;
+  }
   return 1;
 }
 
-int functionsFind(Str name, int *out) {
-  for (int i = 0; i < functionsCount; i++) {
-    if (strEq(name, functions[i].name)) {
-      *out = i;
-      return 1;
+int symbolsFind(ElangVM *vm, Str name, int create) {
+  unsigned int i = strHash(name) & (vm->symbolsTableCap - 1);
+  while (vm->symbolsTable[i] >= 0) {
+    if (strEq(vm->symbols[vm->symbolsTable[i]].name, name)) {
+      return vm->symbolsTable[i];
     }
+    i = (i + 1) & (vm->symbolsTableCap - 1);
   }
-  return 0;
+
+  if (!create) {
+    return -1;
+  }
+
+  if (!ARENA_GROW(vm->symbols, vm->symbolsCap, vm->symbolsCount)) {
+    return -1;
+  }
+
+  vm->symbols[vm->symbolsCount] = (Symbol){.name = name, .function = -1, .variable = -1};
+  vm->symbolsTable[i] = vm->symbolsCount++;
+
+  if (vm->symbolsCount * 2 > vm->symbolsTableCap && !symbolsInit(vm, vm->symbolsTableCap * 2)) {
+    return -1;
+  }
+  return vm->symbolsCount - 1;
 }
 
-Variable variables[PROGRAM_CAP];
-int variablesMax;
-int variablesBase;
-int variablesCount;
+// Program
+int functionsBound(ElangVM *vm, int symbol) {
+  int index = vm->symbols[symbol].function;
+  return index >= 0 && index < vm->functionsCount && vm->functions[index].symbol == symbol;
+}
 
-int variablesPush(Str name, float data) {
-  if (variablesCount >= PROGRAM_CAP) {
-    LOG_ERROR(STR("Variables overflow"));
+int functionsBind(ElangVM *vm, int index) {
+  int symbol = symbolsFind(vm, vm->functions[index].name, 1);
+  if (symbol < 0) {
     return 0;
   }
 
-  variables[variablesCount++] = (Variable){.name = name, .data = data};
+  if (!functionsBound(vm, symbol)) {
+    vm->symbols[symbol].function = index;
+  }
+  vm->functions[index].symbol = symbol;
   return 1;
 }
 
-int variablesFind(Str name, int *out) {
-  for (int i = 0; i < variablesCount; i++) {
-    if (strEq(name, variables[i].name)) {
-      *out = i;
-      return 1;
-    }
+int functionsPush(ElangVM *vm, Str name, int arity, int start) {
+  if (!ARENA_GROW(vm->functions, vm->functionsCap, vm->functionsCount)) {
+    return 0;
   }
-  return 0;
+
+  unsigned long long context = HASH_BASIS;
+  if (vm->functionsCount) {
+    context = vm->functions[vm->functionsCount - 1].context;
+  }
+  context = hashMix(strHashFrom(name, context), 256 + arity * 2 + (start < 0));
+
+  vm->functions[vm->functionsCount++] = (Function){
+    .name = name,
+    .symbol = -1,
+    .arity = arity,
+    .start = start,
+    .context = context,
+  };
+  return 1;
 }
 
-Native natives[PROGRAM_CAP];
-int nativesCount;
+int functionsFind(ElangVM *vm, Str name, int *out) {
+  int symbol = symbolsFind(vm, name, 0);
+  if (symbol < 0 || !functionsBound(vm, symbol)) {
+    return 0;
+  }
 
-// Compiler
-typedef enum {
-  POWER_NIL,
-  POWER_SET,
-  POWER_CMP,
-  POWER_ADD,
-  POWER_MUL,
-  POWER_PRE
-} Power;
+  *out = vm->symbols[symbol].function;
+  return 1;
+}
 
-Power powerFromTokenType(TokenType type) {
+int opsEffect(ElangVM *vm, OpType type, int data) {
   switch (type) {
-  case TOKEN_GT:
-  case TOKEN_GE:
-  case TOKEN_LT:
-  case TOKEN_LE:
-  case TOKEN_EQ:
-  case TOKEN_NE:
-    return POWER_CMP;
-
-  case TOKEN_ADD:
-  case TOKEN_SUB:
-    return POWER_ADD;
+  case OP_NUM:
+  case OP_GETG:
+  case OP_GETL:
+    return 1;
 
-  case TOKEN_MUL:
-  case TOKEN_DIV:
-    return POWER_MUL;
+  case OP_CALL:
+  case OP_NATIVE:
+    return 1 - vm->functions[data].arity;
 
-  case TOKEN_SET:
-    return POWER_SET;
+  case OP_NOT:
+  case OP_NEG:
+  case OP_GOTO:
+    return 0;
 
   default:
-    return POWER_NIL;
+    return -1;
   }
 }
 
-void errorUnexpected(Token token) {
-  LOG_ERROR_LINE(token.row, STR("Unexpected "), strFromTokenType(token.type));
+// Makes room for count more ops, as many as an operand can jump over
+int opsReserve(ElangVM *vm, int count) {
+  if (vm->opsCount + count > OPS_LIMIT) {
+    LOG_ERROR(STR("Program too large"));
+    return 0;
+  }
+
+  return ARENA_GROW(vm->ops, vm->opsCap, vm->opsCount + count - 1);
+}
+
+int opsPush(ElangVM *vm, OpType type, int data) {
+  if (!opsReserve(vm, 1)) {
+    return 0;
+  }
+
+  vm->opsDepth += opsEffect(vm, type, data);
+  if (vm->opsDepthMax < vm->opsDepth) {
+    vm->opsDepthMax = vm->opsDepth;
+  }
+
+  vm->ops[vm->opsCount++] = (Op){.type = type, .data = data};
+  return 1;
+}
+
+int constsPush(ElangVM *vm, float value) {
+  if (!ARENA_GROW(vm->consts, vm->constsCap, vm->constsCount)) {
+    return 0;
+  }
+
+  vm->consts[vm->constsCount++] = value;
+  return 1;
+}
+
+int opsPushNum(ElangVM *vm, float value) {
+  return constsPush(vm, value) && opsPush(vm, OP_NUM, vm->constsCount - 1);
+}
+
+float opsApply(OpType type, float a, float b) {
+  switch (type) {
+  case OP_GT:
+    return a > b;
+
+  case OP_GE:
+    return a >= b;
+
+  case OP_LT:
+    return a < b;
+
+  case OP_LE:
+    return a <= b;
+
+  case OP_EQ:
+    return a == b;
+
+  case OP_NE:
+    return a != b;
+
+  case OP_ADD:
+    return a + b;
+
+  case OP_SUB:
+    return a - b;
+
+  case OP_MUL:
+    return a * b;
+
+  case OP_DIV:
+    return a / b;
+
+  case OP_NOT:
+    return !b;
+
+  case OP_NEG:
+    return -b;
+
+  default:
+    return 0;
+  }
+}
+
+int opsIsPowerOfTwo(float x) {
+  union {
+    float f;
+    unsigned int u;
+  } bits = {.f = x};
+
+  unsigned int exponent = (bits.u >> 23) & 0xff;
+  return (bits.u & 0x7fffff) == 0 && exponent != 0 && exponent != 0xff;
+}
+
+// Drops the last op, a literal, whose constant is always the last one
+void opsDropNum(ElangVM *vm) {
+  vm->opsCount--;
+  vm->opsDepth--;
+  vm->constsCount--;
+}
+
+// An expression whose last op is OP_NUM is that literal, so operators on
+// literals are evaluated here instead of being emitted
+int opsFold(ElangVM *vm, OpType type) {
+  Op *b = vm->opsCount >= 1 ? &vm->ops[vm->opsCount - 1] : 0;
+  Op *a = vm->opsCount >= 2 ? &vm->ops[vm->opsCount - 2] : 0;
+
+  if (!b || b->type != OP_NUM) {
+    return opsPush(vm, type, 0);
+  }
+
+  float *k = &vm->consts[b->data];
+  if (type == OP_NOT || type == OP_NEG) {
+    *k = opsApply(type, 0, *k);
+    return 1;
+  }
+
+  if (a && a->type == OP_NUM) {
+    vm->consts[a->data] = opsApply(type, vm->consts[a->data], *k);
+    opsDropNum(vm);
+    return 1;
+  }
+
+  if (((type == OP_MUL || type == OP_DIV) && *k == 1) ||
+      (type == OP_SUB && *k == 0 && 1 / *k > 0)) {
+    opsDropNum(vm);
+    return 1;
+  }
+
+  if (type == OP_MUL && *k == -1) {
+    opsDropNum(vm);
+    return opsPush(vm, OP_NEG, 0);
+  }
+
+  if (type == OP_DIV && opsIsPowerOfTwo(*k)) {
+    *k = 1 / *k;
+    return opsPush(vm, OP_MUL, 0);
+  }
+
+  return opsPush(vm, type, 0);
+}
+
+int variablesBound(ElangVM *vm, int symbol) {
+  int index = vm->symbols[symbol].variable;
+  return index >= 0 && index < vm->variablesCount && vm->variables[index].symbol == symbol;
+}
+
+int variablesPush(ElangVM *vm, Str name, float data) {
+  if (!ARENA_GROW(vm->variables, vm->variablesCap, vm->variablesCount)) {
+    return 0;
+  }
+
+  int symbol = symbolsFind(vm, name, 1);
+  if (symbol < 0) {
+    return 0;
+  }
+
+  if (!variablesBound(vm, symbol)) {
+    vm->symbols[symbol].variable = vm->variablesCount;
+  }
+
+  unsigned long long context = HASH_BASIS;
+  if (vm->variablesCount) {
+    context = vm->variables[vm->variablesCount - 1].context;
+  }
+
+  vm->variables[vm->variablesCount++] = (Variable){
+    .name = name,
+    .symbol = symbol,
+    .data = data,
+    .context = hashMix(strHashFrom(name, context), 256),
+  };
+  return 1;
+}
+
+int variablesFind(ElangVM *vm, Str name, int *out) {
+  int symbol = symbolsFind(vm, name, 0);
+  if (symbol < 0 || !variablesBound(vm, symbol)) {
+    return 0;
+  }
+
+  *out = vm->symbols[symbol].variable;
+  return 1;
+}
+
+// Stack
+// The stack grows on demand up to stackLimit slots, calls check for room
+// before pushing a frame and rebase their pointers if the stack moved.
+int stackGrow(ElangVM *vm, int count) {
+  if (count > vm->stackLimit) {
+    LOG_ERROR(STR("Stack overflow"));
+    return 0;
+  }
+
+  if (count <= vm->stackCap) {
+    return 1;
+  }
+
+  int cap = vm->stackCap ? vm->stackCap * 2 : 256;
+  while (cap < count) {
+    cap *= 2;
+  }
+
+  if (cap > vm->stackLimit) {
+    cap = vm->stackLimit;
+  }
+
+  float *copy = ARENA_ARRAY(float, cap);
+  if (!copy) {
+    return 0;
+  }
+
+  for (int i = 0; i < vm->stackCap; i++) {
+    copy[i] = vm->stack[i];
+  }
+
+  vm->stack = copy;
+  vm->stackEnd = copy + cap;
+  vm->stackCap = cap;
+  return 1;
+}
+
+// Cache
+// Every function is kept with a hash of its source text and of the names it
+// could see. A function whose text and context are unchanged in the next
+// compilation copies its ops instead of being compiled again, so a reload only
+// compiles the edited functions and the top level. The tables live outside the
+// arena, which the next compilation rewinds.
+int cacheGrow(ElangVM *vm, void **data, int *cap, int size, int count) {
+  if (count < *cap) {
+    return 1;
+  }
+
+  if (!vm->arenaAllocator.alloc) {
+    return 0;
+  }
+
+  int next = *cap ? *cap * 2 : 64;
+  while (next <= count) {
+    next *= 2;
+  }
+
+  char *copy = vm->arenaAllocator.alloc(vm->arenaAllocator.context, next * size);
+  if (!copy) {
+    return 0;
+  }
+
+  char *old = *data;
+  for (int i = 0; i < *cap * size; i++) {
+    copy[i] = old[i];
+  }
+
+  if (old && vm->arenaAllocator.free) {
+    vm->arenaAllocator.free(vm->arenaAllocator.context, old);
+  }
+
+  *data = copy;
+  *cap = next;
+  return 1;
+}
+
+void cacheFree(ElangVM *vm, Cache *cache) {
+  if (vm->arenaAllocator.free) {
+    if (cache->entries) {
+      vm->arenaAllocator.free(vm->arenaAllocator.context, cache->entries);
+    }
+
+    if (cache->ops) {
+      vm->arenaAllocator.free(vm->arenaAllocator.context, cache->ops);
+    }
+
+    if (cache->consts) {
+      vm->arenaAllocator.free(vm->arenaAllocator.context, cache->consts);
+    }
+  }
+  *cache = (Cache){0};
+}
+
+// The names a function body resolves, which are the functions and variables
+// defined before it
+unsigned long long cacheContext(ElangVM *vm) {
+  unsigned long long hash = HASH_BASIS;
+  if (vm->functionsCount) {
+    hash = vm->functions[vm->functionsCount - 1].context;
+  }
+
+  unsigned long long variables = HASH_BASIS;
+  if (vm->variablesCount) {
+    variables = vm->variables[vm->variablesCount - 1].context;
+  }
+
+  return hashMix(hashMix(hash, variables), variables >> 32);
+}
+
+// Looks for the function whose text starts text, starting with the one at the
+// same position in the last compilation
+CacheEntry *cacheFind(ElangVM *vm, Str text, Str name, unsigned long long context) {
+  Cache *cache = &vm->cache;
+  unsigned int hash = strHash(name);
+  int ordinal = vm->functionsCount - vm->nativesCount;
+
+  for (int i = 0; i < cache->entriesCount; i++) {
+    CacheEntry *entry = &cache->entries[(ordinal + i) % cache->entriesCount];
+    if (entry->name == hash && entry->length <= text.count &&
+        entry->hash == strHashFrom((Str){.data = text.data, .count = entry->length}, context)) {
+      return entry;
+    }
+  }
+
+  return 0;
+}
+
+// Keeps the ops of a function for the next compilation, with its literals
+// moved to the constants of the cache. A function that does not fit is simply
+// compiled again.
+void cacheKeep(ElangVM *vm, CacheEntry entry) {
+  Cache *cache = &vm->cacheNext;
+  if (!cacheGrow(vm, (void **)&cache->entries, &cache->entriesCap, sizeof(CacheEntry),
+                 cache->entriesCount) ||
+      !cacheGrow(vm, (void **)&cache->ops, &cache->opsCap, sizeof(Op),
+                 cache->opsCount + entry.count) ||
+      !cacheGrow(vm, (void **)&cache->consts, &cache->constsCap, sizeof(float),
+                 cache->constsCount + entry.count)) {
+    return;
+  }
+
+  entry.ops = cache->opsCount;
+  for (int i = 0; i < entry.count; i++) {
+    Op op = vm->ops[entry.start + i];
+    if (op.type == OP_NUM) {
+      cache->consts[cache->constsCount] = vm->consts[op.data];
+      op.data = cache->constsCount++;
+    }
+    cache->ops[cache->opsCount++] = op;
+  }
+  cache->entries[cache->entriesCount++] = entry;
+}
+
+// Appends the ops of a kept function, with its jumps moved to where it starts now
+int cacheApply(ElangVM *vm, CacheEntry *entry) {
+  Cache *cache = &vm->cache;
+  if (!opsReserve(vm, entry->count)) {
+    return 0;
+  }
+
+  int offset = vm->opsCount - entry->start;
+  for (int i = 0; i < entry->count; i++) {
+    Op op = cache->ops[entry->ops + i];
+    if (op.type == OP_ELSE || op.type == OP_GOTO) {
+      op.data += offset;
+    } else if (op.type == OP_NUM) {
+      if (!constsPush(vm, cache->consts[op.data])) {
+        return 0;
+      }
+      op.data = vm->constsCount - 1;
+    }
+    vm->ops[vm->opsCount++] = op;
+  }
+
+  // Locals leave their slots marked, as compiling the body would have
+  if (!ARENA_GROW(vm->variables, vm->variablesCap, vm->variablesBase + entry->body)) {
+    return 0;
+  }
+
+  for (int i = 0; i < entry->body; i++) {
+    vm->variables[vm->variablesBase + i] = (Variable){.symbol = -1, .data = 1};
+  }
+  vm->variablesMax = vm->variablesBase + entry->body;
+  return 1;
+}
+
+// Compiler
+typedef enum {
+  POWER_NIL,
+  POWER_SET,
+  POWER_CMP,
+  POWER_ADD,
+  POWER_MUL,
+  POWER_PRE
+} Power;
+
+Power powerFromTokenType(TokenType type) {
+  switch (type) {
+  case TOKEN_GT:
+  case TOKEN_GE:
+  case TOKEN_LT:
+  case TOKEN_LE:
+  case TOKEN_EQ:
+  case TOKEN_NE:
+    return POWER_CMP;
+
+  case TOKEN_ADD:
+  case TOKEN_SUB:
+    return POWER_ADD;
+
+  case TOKEN_MUL:
+  case TOKEN_DIV:
+    return POWER_MUL;
+
+  case TOKEN_SET:
+    return POWER_SET;
+
+  default:
+    return POWER_NIL;
+  }
+}
+
+void errorUnexpected(Token token) {
+  LOG_ERROR_LINE(token.row, STR("Unexpected "), strFromTokenType(token.type));
 }
 
 void errorUndefined(Token token, Str label) {
   LOG_ERROR_LINE(token.row, STR("Undefined "), label, STR(" '"), token.str, STR("'"));
 }
 
-int compileExpr(Power base) {
+int compileExpr(ElangVM *vm, Power base) {
   Token token;
-  if (!lexerNext(&token)) {
+  if (!lexerNext(vm, &token)) {
     return 0;
   }
 
@@ -648,46 +1577,46 @@ int compileExpr(Power base) {
       return 0;
     }
 
-    if (!opsPush(OP_NUM, data)) {
+    if (!opsPushNum(vm, data)) {
       return 0;
     }
   } break;
 
   case TOKEN_IDENT: {
     Token new;
-    if (!lexerPeek(&new)) {
+    if (!lexerPeek(vm, &new)) {
       return 0;
     }
 
     if (new.type == TOKEN_LPAREN) {
-      lexerBuffer = 0;
+      vm->lexerBuffer = 0;
 
       int index;
-      if (!functionsFind(token.str, &index)) {
+      if (!functionsFind(vm, token.str, &index)) {
         errorUndefined(token, STR("function"));
         return 0;
       }
 
-      for (int i = 0; i < functions[index].arity; i++) {
-        if (i && !lexerNextExpect(&token, TOKEN_COMMA)) {
+      for (int i = 0; i < vm->functions[index].arity; i++) {
+        if (i && !lexerNextExpect(vm, &token, TOKEN_COMMA)) {
           return 0;
         }
 
-        if (!compileExpr(POWER_SET)) {
+        if (!compileExpr(vm, POWER_SET)) {
           return 0;
         }
       }
 
-      if (!lexerNextExpect(&new, TOKEN_RPAREN)) {
+      if (!lexerNextExpect(vm, &new, TOKEN_RPAREN)) {
         return 0;
       }
 
-      if (functions[index].start < 0) {
-        if (!opsPush(OP_NATIVE, index)) {
+      if (vm->functions[index].start < 0) {
+        if (!opsPush(vm, OP_NATIVE, index)) {
           return 0;
         }
       } else {
-        if (!opsPush(OP_CALL, index)) {
+        if (!opsPush(vm, OP_CALL, index)) {
           return 0;
         }
       }
@@ -696,37 +1625,37 @@ int compileExpr(Power base) {
         errorUnexpected(new);
         return 0;
       }
-      lexerBuffer = 0;
+      vm->lexerBuffer = 0;
 
-      if (!compileExpr(POWER_SET)) {
+      if (!compileExpr(vm, POWER_SET)) {
         return 0;
       }
 
-      int index = variablesCount;
-      if (!variablesFind(token.str, &index)) {
-        if (!variablesPush(token.str, functionsLocal)) {
+      int index = vm->variablesCount;
+      if (!variablesFind(vm, token.str, &index)) {
+        if (!variablesPush(vm, token.str, vm->functionsLocal)) {
           return 0;
         }
       }
 
-      if (variables[index].data) {
-        return opsPush(OP_SETL, index - variablesBase);
+      if (vm->variables[index].data) {
+        return opsPush(vm, OP_SETL, index - vm->variablesBase);
       } else {
-        return opsPush(OP_SETG, index);
+        return opsPush(vm, OP_SETG, index);
       }
     } else {
       int index;
-      if (!variablesFind(token.str, &index)) {
+      if (!variablesFind(vm, token.str, &index)) {
         errorUndefined(token, STR("variable"));
         return 0;
       }
 
-      if (variables[index].data) {
-        if (!opsPush(OP_GETL, index - variablesBase)) {
+      if (vm->variables[index].data) {
+        if (!opsPush(vm, OP_GETL, index - vm->variablesBase)) {
           return 0;
         }
       } else {
-        if (!opsPush(OP_GETG, index)) {
+        if (!opsPush(vm, OP_GETG, index)) {
           return 0;
         }
       }
@@ -734,31 +1663,31 @@ int compileExpr(Power base) {
   } break;
 
   case TOKEN_NOT:
-    if (!compileExpr(POWER_PRE)) {
+    if (!compileExpr(vm, POWER_PRE)) {
       return 0;
     }
 
-    if (!opsPush(OP_NOT, 0)) {
+    if (!opsFold(vm, OP_NOT)) {
       return 0;
     }
     break;
 
   case TOKEN_SUB:
-    if (!compileExpr(POWER_PRE)) {
+    if (!compileExpr(vm, POWER_PRE)) {
       return 0;
     }
 
-    if (!opsPush(OP_NEG, 0)) {
+    if (!opsFold(vm, OP_NEG)) {
       return 0;
     }
     break;
 
   case TOKEN_LPAREN:
-    if (!compileExpr(POWER_SET)) {
+    if (!compileExpr(vm, POWER_SET)) {
       return 0;
     }
 
-    if (!lexerNextExpect(&token, TOKEN_RPAREN)) {
+    if (!lexerNextExpect(vm, &token, TOKEN_RPAREN)) {
       return 0;
     }
     break;
@@ -769,7 +1698,7 @@ int compileExpr(Power base) {
   }
 
   while (1) {
-    if (!lexerPeek(&token)) {
+    if (!lexerPeek(vm, &token)) {
       return 0;
     }
 
@@ -777,69 +1706,69 @@ int compileExpr(Power base) {
     if (left <= base) {
       break;
     }
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
 
-    if (!compileExpr(left)) {
+    if (!compileExpr(vm, left)) {
       return 0;
     }
 
     switch (token.type) {
     case TOKEN_GT:
-      if (!opsPush(OP_GT, 0)) {
+      if (!opsFold(vm, OP_GT)) {
         return 0;
       }
       break;
 
     case TOKEN_GE:
-      if (!opsPush(OP_GE, 0)) {
+      if (!opsFold(vm, OP_GE)) {
         return 0;
       }
       break;
 
     case TOKEN_LT:
-      if (!opsPush(OP_LT, 0)) {
+      if (!opsFold(vm, OP_LT)) {
         return 0;
       }
       break;
 
     case TOKEN_LE:
-      if (!opsPush(OP_LE, 0)) {
+      if (!opsFold(vm, OP_LE)) {
         return 0;
       }
       break;
 
     case TOKEN_EQ:
-      if (!opsPush(OP_EQ, 0)) {
+      if (!opsFold(vm, OP_EQ)) {
         return 0;
       }
       break;
 
     case TOKEN_NE:
-      if (!opsPush(OP_NE, 0)) {
+      if (!opsFold(vm, OP_NE)) {
         return 0;
       }
       break;
 
     case TOKEN_ADD:
-      if (!opsPush(OP_ADD, 0)) {
+      if (!opsFold(vm, OP_ADD)) {
         return 0;
       }
       break;
 
     case TOKEN_SUB:
-      if (!opsPush(OP_SUB, 0)) {
+      if (!opsFold(vm, OP_SUB)) {
         return 0;
       }
       break;
 
     case TOKEN_MUL:
-      if (!opsPush(OP_MUL, 0)) {
+      if (!opsFold(vm, OP_MUL)) {
         return 0;
       }
       break;
 
     case TOKEN_DIV:
-      if (!opsPush(OP_DIV, 0)) {
+      if (!opsFold(vm, OP_DIV)) {
         return 0;
       }
       break;
@@ -852,19 +1781,19 @@ int compileExpr(Power base) {
   return 1;
 }
 
-int compileStmt(void) {
+int compileStmt(ElangVM *vm) {
   Token token;
-  if (!lexerPeek(&token)) {
+  if (!lexerPeek(vm, &token)) {
     return 0;
   }
 
   switch (token.type) {
   case TOKEN_LBRACE: {
-    int scopeStart = variablesCount;
+    int scopeStart = vm->variablesCount;
 
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
     while (1) {
-      if (!lexerPeek(&token)) {
+      if (!lexerPeek(vm, &token)) {
         return 0;
       }
 
@@ -872,201 +1801,253 @@ int compileStmt(void) {
         break;
       }
 
-      if (!compileStmt()) {
+      if (!compileStmt(vm)) {
         return 0;
       }
     }
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
 
-    if (variablesMax < variablesCount) {
-      variablesMax = variablesCount;
+    if (vm->variablesMax < vm->variablesCount) {
+      vm->variablesMax = vm->variablesCount;
     }
 
-    variablesCount = scopeStart;
+    vm->variablesCount = scopeStart;
   } break;
 
   case TOKEN_IF: {
-    lexerBuffer = 0;
-    if (!compileExpr(POWER_SET)) {
+    vm->lexerBuffer = 0;
+    if (!compileExpr(vm, POWER_SET)) {
       return 0;
     }
 
-    if (!lexerPeekExpect(TOKEN_LBRACE)) {
+    if (!lexerPeekExpect(vm, TOKEN_LBRACE)) {
       return 0;
     }
 
-    int thenAddr = opsCount;
-    if (!opsPush(OP_ELSE, 0)) {
+    int thenAddr = vm->opsCount;
+    if (!opsPush(vm, OP_ELSE, 0)) {
       return 0;
     }
 
-    if (!compileStmt()) {
+    if (!compileStmt(vm)) {
       return 0;
     }
 
-    if (!lexerPeek(&token)) {
+    if (!lexerPeek(vm, &token)) {
       return 0;
     }
 
     if (token.type == TOKEN_ELSE) {
-      lexerBuffer = 0;
+      vm->lexerBuffer = 0;
 
-      if (!lexerPeekExpect(TOKEN_LBRACE)) {
+      if (!lexerPeekExpect(vm, TOKEN_LBRACE)) {
         return 0;
       }
 
-      int elseAddr = opsCount;
-      if (!opsPush(OP_GOTO, 0)) {
+      int elseAddr = vm->opsCount;
+      if (!opsPush(vm, OP_GOTO, 0)) {
         return 0;
       }
 
-      ops[thenAddr].data = opsCount;
+      vm->ops[thenAddr].data = vm->opsCount;
 
-      if (!compileStmt()) {
+      if (!compileStmt(vm)) {
         return 0;
       }
 
-      ops[elseAddr].data = opsCount;
+      vm->ops[elseAddr].data = vm->opsCount;
     } else {
-      ops[thenAddr].data = opsCount;
+      vm->ops[thenAddr].data = vm->opsCount;
     }
   } break;
 
   case TOKEN_WHILE: {
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
 
-    int condAddr = opsCount;
-    if (!compileExpr(POWER_SET)) {
+    int condAddr = vm->opsCount;
+    if (!compileExpr(vm, POWER_SET)) {
       return 0;
     }
 
-    if (!lexerPeekExpect(TOKEN_LBRACE)) {
+    if (!lexerPeekExpect(vm, TOKEN_LBRACE)) {
       return 0;
     }
 
-    int bodyAddr = opsCount;
-    if (!opsPush(OP_ELSE, 0)) {
+    int bodyAddr = vm->opsCount;
+    if (!opsPush(vm, OP_ELSE, 0)) {
       return 0;
     }
 
-    if (!compileStmt()) {
+    if (!compileStmt(vm)) {
       return 0;
     }
 
-    if (!opsPush(OP_GOTO, condAddr)) {
+    if (!opsPush(vm, OP_GOTO, condAddr)) {
       return 0;
     }
 
-    ops[bodyAddr].data = opsCount;
+    vm->ops[bodyAddr].data = vm->opsCount;
   } break;
 
   case TOKEN_FN: {
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
+
+    // The function and everything after it, it ends where its body does
+    char *end = vm->lexerStr.data + vm->lexerStr.count;
+    Str text = {.data = token.str.data, .count = end - token.str.data};
+    int textRow = token.row;
 
-    if (functionsLocal) {
+    if (vm->functionsLocal) {
       errorUnexpected(token);
       return 0;
     }
-    functionsLocal = 1;
+    vm->functionsLocal = 1;
 
-    variablesMax = variablesCount;
-    variablesBase = variablesCount;
+    vm->variablesMax = vm->variablesCount;
+    vm->variablesBase = vm->variablesCount;
 
-    if (!lexerNextExpect(&token, TOKEN_IDENT)) {
+    if (!lexerNextExpect(vm, &token, TOKEN_IDENT)) {
       return 0;
     }
     Str name = token.str;
+    int row = token.row;
 
     int index;
-    if (functionsFind(token.str, &index)) {
+    if (functionsFind(vm, token.str, &index)) {
       LOG_ERROR_LINE(token.row, STR("Redefinition of function '"), token.str, STR("'"));
       return 0;
     }
 
-    if (!lexerNextExpect(&token, TOKEN_LPAREN)) {
-      return 0;
-    }
+    int bodyAddr = vm->opsCount;
+    unsigned long long context = cacheContext(vm);
+    CacheEntry *entry = cacheFind(vm, text, name, context);
+    CacheEntry kept = {0};
 
-    int arity = 0;
-    while (1) {
-      if (!lexerPeek(&token)) {
+    if (entry) {
+      kept = *entry;
+      if (!cacheApply(vm, entry) || !functionsPush(vm, name, kept.arity, bodyAddr + 1) ||
+          !functionsBind(vm, vm->functionsCount - 1)) {
         return 0;
       }
 
-      if (token.type == TOKEN_RPAREN) {
-        lexerBuffer = 0;
-        break;
+      vm->lexerStr = (Str){.data = text.data + kept.length, .count = text.count - kept.length};
+      vm->lexerRow = textRow + kept.rows;
+    } else {
+      if (!lexerNextExpect(vm, &token, TOKEN_LPAREN)) {
+        return 0;
+      }
+
+      int arity = 0;
+      while (1) {
+        if (!lexerPeek(vm, &token)) {
+          return 0;
+        }
+
+        if (token.type == TOKEN_RPAREN) {
+          vm->lexerBuffer = 0;
+          break;
+        }
+
+        if (arity && !lexerNextExpect(vm, &token, TOKEN_COMMA)) {
+          return 0;
+        }
+
+        if (!lexerNextExpect(vm, &token, TOKEN_IDENT)) {
+          return 0;
+        }
+
+        if (!variablesPush(vm, token.str, vm->functionsLocal)) {
+          return 0;
+        }
+
+        arity++;
       }
 
-      if (arity && !lexerNextExpect(&token, TOKEN_COMMA)) {
+      if (!lexerPeekExpect(vm, TOKEN_LBRACE)) {
         return 0;
       }
 
-      if (!lexerNextExpect(&token, TOKEN_IDENT)) {
+      if (!opsPush(vm, OP_GOTO, 0)) {
         return 0;
       }
 
-      if (!variablesPush(token.str, functionsLocal)) {
+      if (!functionsPush(vm, name, arity, vm->opsCount) ||
+          !functionsBind(vm, vm->functionsCount - 1)) {
         return 0;
       }
 
-      arity++;
-    }
+      int depthMax = vm->opsDepthMax;
+      vm->opsDepthMax = 0;
 
-    if (!lexerPeekExpect(TOKEN_LBRACE)) {
-      return 0;
-    }
+      if (!compileStmt(vm)) {
+        return 0;
+      }
 
-    int bodyAddr = opsCount;
-    if (!opsPush(OP_GOTO, 0)) {
-      return 0;
-    }
+      int body = vm->variablesMax - vm->variablesBase;
 
-    if (!functionsPush(name, arity, opsCount)) {
-      return 0;
-    }
+      if (!opsPushNum(vm, 0)) {
+        return 0;
+      }
 
-    if (!compileStmt()) {
-      return 0;
+      if (!opsPush(vm, OP_RETURN, vm->functionsCount - 1)) {
+        return 0;
+      }
+      vm->ops[bodyAddr].data = vm->opsCount;
+
+      int length = vm->lexerStr.data - text.data;
+      kept = (CacheEntry){
+        .hash = strHashFrom((Str){.data = text.data, .count = length}, context),
+        .name = strHash(name),
+        .length = length,
+        .arity = arity,
+        .body = body,
+        .depth = vm->opsDepthMax,
+      };
+
+      for (int i = 0; i < kept.length; i++) {
+        kept.rows += text.data[i] == '\n';
+      }
+      vm->opsDepthMax = depthMax;
     }
 
-    functions[functionsCount - 1].body = variablesMax - variablesBase;
-
-    if (!opsPush(OP_NUM, 0)) {
+    Function *f = &vm->functions[vm->functionsCount - 1];
+    f->body = kept.body;
+    f->depth = kept.depth;
+    if (f->body + 2 + f->depth > vm->stackLimit) {
+      LOG_ERROR_LINE(row, STR("Stack overflow in function '"), name, STR("'"));
       return 0;
     }
 
-    if (!opsPush(OP_RETURN, functionsCount - 1)) {
-      return 0;
-    }
-    ops[bodyAddr].data = opsCount;
+    kept.start = bodyAddr;
+    kept.count = vm->opsCount - bodyAddr;
+    cacheKeep(vm, kept);
 
-    functionsLocal = 0;
-    variablesCount = variablesBase;
+    vm->functionsLocal = 0;
+    vm->variablesCount = vm->variablesBase;
   } break;
 
   case TOKEN_RETURN:
-    lexerBuffer = 0;
+    vm->lexerBuffer = 0;
 
-    if (!functionsLocal) {
+    if (!vm->functionsLocal) {
       errorUnexpected(token);
       return 0;
     }
 
-    if (!compileExpr(POWER_SET)) {
+    if (!compileExpr(vm, POWER_SET)) {
       return 0;
     }
 
-    return opsPush(OP_RETURN, functionsCount - 1);
+    return opsPush(vm, OP_RETURN, vm->functionsCount - 1);
 
   default: {
-    if (!compileExpr(POWER_NIL)) {
+    if (!compileExpr(vm, POWER_NIL)) {
       return 0;
     }
 
-    OpType last = ops[opsCount - 1].type;
+    OpType last = vm->ops[vm->opsCount - 1].type;
     if (last != OP_SETG && last != OP_SETL) {
-      return opsPush(OP_DROP, 0);
+      return opsPush(vm, OP_DROP, 0);
     }
   }
   }
@@ -1074,70 +2055,380 @@ int compileStmt(void) {
   return 1;
 }
 
-// Stack
-#define STACK_CAP 1024
+// Optimize
+void opsTargetsFind(ElangVM *vm) {
+  for (int i = 0; i <= vm->opsCount; i++) {
+    vm->opsTarget[i] = 0;
+  }
 
-float stack[STACK_CAP];
-int stackCount;
+  for (int i = 0; i < vm->opsCount; i++) {
+    if (vm->ops[i].type == OP_ELSE || vm->ops[i].type == OP_GOTO) {
+      vm->opsTarget[vm->ops[i].data] = 1;
+    }
+  }
 
-int stackPop(float *out) {
-  if (!stackCount) {
-    return 0;
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    vm->opsTarget[vm->functions[i].start] = 1;
   }
+}
 
-  *out = stack[--stackCount];
-  return 1;
+void opsReach(ElangVM *vm, int start, int *count) {
+  if (start < vm->opsCount && !vm->opsLive[start]) {
+    vm->opsLive[start] = 1;
+    vm->opsWork[(*count)++] = start;
+  }
 }
 
-int stackPush(float value) {
-  if (stackCount >= STACK_CAP) {
-    LOG_ERROR(STR("Stack overflow"));
+int opsOptimize(ElangVM *vm) {
+  vm->opsMap = ARENA_ARRAY(int, vm->opsCount + 1);
+  vm->opsTarget = ARENA_ARRAY(char, vm->opsCount + 1);
+  vm->opsLive = ARENA_ARRAY(char, vm->opsCount + 1);
+  vm->opsWork = ARENA_ARRAY(int, vm->opsCount + 1);
+  if (!vm->opsMap || !vm->opsTarget || !vm->opsLive || !vm->opsWork) {
     return 0;
   }
 
-  stack[stackCount++] = value;
-  return 1;
-}
+  opsTargetsFind(vm);
 
-// Elang
-#define UNARY_OP(op)                                                                               \
-  do {                                                                                             \
-    if (!stackPop(&a)) {                                                                           \
-      return 0;                                                                                    \
+  for (int i = 0; i + 1 < vm->opsCount; i++) {
+    if (vm->ops[i].type == OP_NUM && vm->ops[i + 1].type == OP_ELSE && !vm->opsTarget[i + 1]) {
+      if (vm->consts[vm->ops[i].data]) {
+        vm->ops[i] = (Op){.type = OP_GOTO, .data = i + 2};
+      } else {
+        vm->ops[i] = (Op){.type = OP_GOTO, .data = vm->ops[i + 1].data};
+      }
+      vm->ops[i + 1] = vm->ops[i];
+    }
+  }
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    vm->opsLive[i] = 0;
+  }
+
+  int count = 0;
+  opsReach(vm, 0, &count);
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    opsReach(vm, vm->functions[i].start - 1, &count);
+    opsReach(vm, vm->functions[i].start, &count);
+  }
+
+  while (count) {
+    int i = vm->opsWork[--count];
+    switch (vm->ops[i].type) {
+    case OP_ELSE:
+      opsReach(vm, vm->ops[i].data, &count);
+      opsReach(vm, i + 1, &count);
+      break;
+
+    case OP_GOTO:
+      opsReach(vm, vm->ops[i].data, &count);
+      break;
+
+    case OP_RETURN:
+      break;
+
+    default:
+      opsReach(vm, i + 1, &count);
+    }
+  }
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    if (vm->opsLive[i] && vm->ops[i].type == OP_GOTO) {
+      int next = i + 1;
+      while (next < vm->opsCount && !vm->opsLive[next]) {
+        next++;
+      }
+
+      if (next == vm->ops[i].data) {
+        vm->opsLive[i] = 0;
+      }
+    }
+  }
+
+  count = 0;
+  for (int i = 0; i < vm->opsCount; i++) {
+    vm->opsMap[i] = count;
+    if (vm->opsLive[i]) {
+      vm->ops[count++] = vm->ops[i];
+    }
+  }
+  vm->opsMap[vm->opsCount] = count;
+  vm->opsCount = count;
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    if (vm->ops[i].type == OP_ELSE || vm->ops[i].type == OP_GOTO) {
+      vm->ops[i].data = vm->opsMap[vm->ops[i].data];
+    }
+  }
+
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    vm->functions[i].start = vm->opsMap[vm->functions[i].start];
+  }
+
+  return 1;
+}
+
+// Fuse
+int opsLength(ElangVM *vm, Op op) {
+  switch (op.type) {
+  case OP_GTK_ELSE:
+  case OP_GEK_ELSE:
+  case OP_LTK_ELSE:
+  case OP_LEK_ELSE:
+  case OP_EQK_ELSE:
+  case OP_NEK_ELSE:
+  case OP_INCL:
+  case OP_INCG:
+    return 2;
+
+  case OP_NATIVEL:
+    return 1 + vm->functions[op.data].arity;
+
+  default:
+    return 1;
+  }
+}
+
+int opsIsCompare(OpType type) {
+  return type >= OP_GT && type <= OP_NE;
+}
+
+int opsFusable(ElangVM *vm, int start, int count) {
+  if (start + count > vm->opsCount) {
+    return 0;
+  }
+
+  for (int i = start + 1; i < start + count; i++) {
+    if (vm->opsTarget[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Superinstructions keep their operands in the slots following the opcode
+int opsFuse(ElangVM *vm) {
+  vm->opsFused = ARENA_ARRAY(Op, vm->opsCount + 1);
+  if (!vm->opsFused) {
+    return 0;
+  }
+
+  opsTargetsFind(vm);
+
+  int count = 0;
+  for (int i = 0; i < vm->opsCount;) {
+    Op *op = &vm->ops[i];
+    vm->opsMap[i] = count;
+
+    int arity = 0;
+    while (i + arity < vm->opsCount && op[arity].type == OP_GETL) {
+      arity++;
+    }
+
+    if (opsFusable(vm, i, 2) && opsIsCompare(op[0].type) && op[1].type == OP_ELSE) {
+      vm->opsFused[count++] = (Op){.type = OP_GT_ELSE + op[0].type - OP_GT, .data = op[1].data};
+      i += 2;
+    } else if (opsFusable(vm, i, 3) && op[0].type == OP_NUM && opsIsCompare(op[1].type) &&
+               op[2].type == OP_ELSE) {
+      vm->opsFused[count++] = (Op){.type = OP_GTK_ELSE + op[1].type - OP_GT, .data = op[0].data};
+      vm->opsFused[count++] = (Op){.type = OP_NUM, .data = op[2].data};
+      i += 3;
+    } else if (opsFusable(vm, i, 4) && op[1].type == OP_NUM &&
+               (op[2].type == OP_ADD || op[2].type == OP_SUB) && op[3].data == op[0].data &&
+               ((op[0].type == OP_GETL && op[3].type == OP_SETL) ||
+                (op[0].type == OP_GETG && op[3].type == OP_SETG))) {
+      int step = op[1].data;
+      if (op[2].type == OP_SUB) {
+        if (!constsPush(vm, -vm->consts[step])) {
+          return 0;
+        }
+        step = vm->constsCount - 1;
+      }
+
+      OpType type = op[0].type == OP_GETL ? OP_INCL : OP_INCG;
+      vm->opsFused[count++] = (Op){.type = type, .data = op[0].data};
+      vm->opsFused[count++] = (Op){.type = OP_NUM, .data = step};
+      i += 4;
+    } else if (arity && opsFusable(vm, i, arity + 1) && op[arity].type == OP_NATIVE &&
+               vm->functions[op[arity].data].arity == arity) {
+      vm->opsFused[count++] = (Op){.type = OP_NATIVEL, .data = op[arity].data};
+      for (int j = 0; j < arity; j++) {
+        vm->opsFused[count++] = (Op){.type = OP_NUM, .data = op[j].data};
+      }
+      i += arity + 1;
+    } else {
+      vm->opsFused[count++] = *op;
+      i++;
+    }
+  }
+  vm->opsMap[vm->opsCount] = count;
+
+  // The ops may be loaded bytecode, which is never written
+  vm->ops = vm->opsFused;
+  vm->opsCap = vm->opsCount + 1;
+  vm->opsCount = count;
+
+  for (int i = 0; i < vm->opsCount; i += opsLength(vm, vm->ops[i])) {
+    switch (vm->ops[i].type) {
+    case OP_ELSE:
+    case OP_GOTO:
+    case OP_GT_ELSE:
+    case OP_GE_ELSE:
+    case OP_LT_ELSE:
+    case OP_LE_ELSE:
+    case OP_EQ_ELSE:
+    case OP_NE_ELSE:
+      vm->ops[i].data = vm->opsMap[vm->ops[i].data];
+      break;
+
+    case OP_GTK_ELSE:
+    case OP_GEK_ELSE:
+    case OP_LTK_ELSE:
+    case OP_LEK_ELSE:
+    case OP_EQK_ELSE:
+    case OP_NEK_ELSE:
+      vm->ops[i + 1].data = vm->opsMap[vm->ops[i + 1].data];
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  for (int i = vm->nativesCount; i < vm->functionsCount; i++) {
+    vm->functions[i].start = vm->opsMap[vm->functions[i].start];
+  }
+
+  return 1;
+}
+
+// Budget
+// Calls and jumps back only count down budgetSteps, the fuel and the clock are
+// looked at once it runs out. It is armed with the fuel left, or with
+// BUDGET_CLOCK_STEPS when there is a clock, so neither check comes late.
+#define BUDGET_CLOCK_STEPS 4096
+#define BUDGET_STEPS_MAX (1 << 30)
+
+void budgetArm(ElangVM *vm) {
+  long long steps = BUDGET_STEPS_MAX;
+  if (vm->budgetFuel && vm->budgetFuelLeft < steps) {
+    steps = vm->budgetFuelLeft;
+  }
+
+  if (vm->budgetClock && steps > BUDGET_CLOCK_STEPS) {
+    steps = BUDGET_CLOCK_STEPS;
+  }
+
+  vm->budgetSteps = steps;
+  vm->budgetArmed = steps;
+}
+
+void budgetStart(ElangVM *vm) {
+  vm->budgetFailed = 0;
+  vm->budgetFuelLeft = vm->budgetFuel;
+  if (vm->budgetClock) {
+    vm->budgetDeadline = vm->budgetClock(vm->budgetClockContext) + vm->budgetTime;
+  }
+  budgetArm(vm);
+}
+
+// Called with budgetSteps at -1, after budgetArmed + 1 steps or once a native failed
+int budgetCheck(ElangVM *vm) {
+  if (vm->budgetFailed) {
+    return 0;
+  }
+
+  vm->budgetFuelLeft -= vm->budgetArmed + 1;
+  if (vm->budgetFuel && vm->budgetFuelLeft < 0) {
+    LOG_ERROR(STR("Out of fuel"));
+    return 0;
+  }
+
+  if (vm->budgetClock && vm->budgetClock(vm->budgetClockContext) > vm->budgetDeadline) {
+    LOG_ERROR(STR("Time limit exceeded"));
+    return 0;
+  }
+
+  budgetArm(vm);
+  return 1;
+}
+
+// Elang
+#define UNARY_OP(op) sp[-1] = op(sp[-1])
+
+#define BINARY_OP(op)                                                                              \
+  do {                                                                                             \
+    sp--;                                                                                          \
+    sp[-1] = sp[-1] op sp[0];                                                                      \
+  } while (0)
+
+#define FUSED_ELSE(op)                                                                             \
+  do {                                                                                             \
+    sp -= 2;                                                                                       \
+    if (!(sp[0] op sp[1])) {                                                                       \
+      i = vm->ops[i].data - 1;                                                                     \
     }                                                                                              \
-                                                                                                   \
-    if (!stackPush(op(a))) {                                                                       \
-      return 0;                                                                                    \
+  } while (0)
+
+#define FUSED_ELSEK(op)                                                                            \
+  do {                                                                                             \
+    sp--;                                                                                          \
+    if (!(sp[0] op vm->consts[vm->ops[i].data])) {                                                 \
+      i = vm->ops[i + 1].data - 1;                                                                 \
+    } else {                                                                                       \
+      i++;                                                                                         \
     }                                                                                              \
   } while (0)
 
-#define BINARY_OP(op)                                                                              \
+#define FUSED_NATIVEL()                                                                            \
   do {                                                                                             \
-    if (!stackPop(&b)) {                                                                           \
-      return 0;                                                                                    \
+    Function *f = &vm->functions[vm->ops[i].data];                                                 \
+    for (int j = 0; j < f->arity; j++) {                                                           \
+      sp[j] = fp[vm->ops[i + 1 + j].data];                                                         \
     }                                                                                              \
                                                                                                    \
-    if (!stackPop(&a)) {                                                                           \
-      return 0;                                                                                    \
+    a = vm->natives[-f->start - 1](vm, sp);                                                        \
+    *sp++ = a;                                                                                     \
+    i += f->arity;                                                                                 \
+  } while (0)
+
+#ifdef ELANG_COUNT
+#define COUNT_DISPATCH() vm->dispatched++
+#else
+#define COUNT_DISPATCH()
+#endif
+
+#define CALL_CHECK(f)                                                                              \
+  do {                                                                                             \
+    int need = sp - vm->stack + (f)->body - (f)->arity + 2 + (f)->depth;                           \
+    if (need > vm->stackCap) {                                                                     \
+      float *old = vm->stack;                                                                      \
+      if (!stackGrow(vm, need)) {                                                                  \
+        return 0;                                                                                  \
+      }                                                                                            \
+      sp = vm->stack + (sp - old);                                                                 \
+      fp = vm->stack + (fp - old);                                                                 \
     }                                                                                              \
-                                                                                                   \
-    if (!stackPush(a op b)) {                                                                      \
+  } while (0)
+
+#define BUDGET_STEP()                                                                              \
+  do {                                                                                             \
+    if (--vm->budgetSteps < 0 && !budgetCheck(vm)) {                                               \
       return 0;                                                                                    \
     }                                                                                              \
   } while (0)
 
-int elangRun(void) {
-  stackCount = 0;
+int elangRunSwitch(ElangVM *vm) {
+  float *sp = vm->stack;
+  float *fp = vm->stack;
+  float a;
+  for (int i = 0; i < vm->opsCount; i++) {
+    COUNT_DISPATCH();
 
-  int frame = 0;
-  float a, b;
-  for (int i = 0; i < opsCount; i++) {
-    Op op = ops[i];
+    Op op = vm->ops[i];
     switch (op.type) {
     case OP_NUM:
-      if (!stackPush(op.data)) {
-        return 0;
-      }
+      *sp++ = vm->consts[op.data];
       break;
 
     case OP_GT:
@@ -1189,110 +2480,127 @@ int elangRun(void) {
       break;
 
     case OP_ELSE:
-      if (!stackPop(&a)) {
-        return 0;
-      }
-
-      if (!a) {
+      if (!*--sp) {
         i = op.data - 1;
       }
       break;
 
     case OP_GOTO:
+      if (op.data <= i) {
+        BUDGET_STEP();
+      }
       i = op.data - 1;
       break;
 
     case OP_CALL: {
-      Function *f = &functions[(int)op.data];
-
-      stackCount += f->body - f->arity;
-      if (stackCount > STACK_CAP) {
-        return 0;
-      }
-
-      if (!stackPush(i)) {
-        return 0;
-      }
+      Function *f = &vm->functions[op.data];
+      BUDGET_STEP();
+      CALL_CHECK(f);
 
-      if (!stackPush(frame)) {
-        return 0;
-      }
+      sp += f->body - f->arity;
+      *sp++ = i;
+      *sp++ = fp - vm->stack;
 
-      frame = stackCount - f->body - 2;
+      fp = sp - f->body - 2;
       i = f->start - 1;
     } break;
 
     case OP_NATIVE: {
-      Function *f = &functions[(int)op.data];
+      Function *f = &vm->functions[op.data];
+      sp -= f->arity;
 
-      stackCount -= f->arity;
-      if (stackCount < 0) {
-        return 0;
-      }
+      a = vm->natives[-f->start - 1](vm, sp);
+      *sp++ = a;
+    } break;
 
-      float result = natives[-f->start - 1](stack + stackCount);
-      if (!stackPush(result)) {
-        return 0;
-      }
+    case OP_RETURN: {
+      Function *f = &vm->functions[op.data];
+      a = *--sp;
+      fp = vm->stack + (int)*--sp;
+      i = *--sp;
+
+      sp -= f->body;
+      *sp++ = a;
     } break;
 
-    case OP_RETURN:
-      if (!stackPop(&a)) {
-        return 0;
-      }
+    case OP_DROP:
+      sp--;
+      break;
 
-      if (!stackPop(&b)) {
-        return 0;
-      }
-      frame = b;
+    case OP_GETG:
+      *sp++ = vm->variables[op.data].data;
+      break;
 
-      if (!stackPop(&b)) {
-        return 0;
-      }
-      i = b;
+    case OP_SETG:
+      vm->variables[op.data].data = *--sp;
+      break;
 
-      stackCount -= functions[(int)op.data].body;
-      if (stackCount < 0) {
-        return 0;
-      }
+    case OP_GETL:
+      *sp++ = fp[op.data];
+      break;
 
-      if (!stackPush(a)) {
-        return 0;
-      }
+    case OP_SETL:
+      fp[op.data] = *--sp;
       break;
 
-    case OP_DROP:
-      if (!stackPop(&a)) {
-        return 0;
-      }
+    case OP_GT_ELSE:
+      FUSED_ELSE(>);
       break;
 
-    case OP_GETG:
-      if (!stackPush(variables[(int)op.data].data)) {
-        return 0;
-      }
+    case OP_GE_ELSE:
+      FUSED_ELSE(>=);
       break;
 
-    case OP_SETG:
-      if (!stackPop(&a)) {
-        return 0;
-      }
+    case OP_LT_ELSE:
+      FUSED_ELSE(<);
+      break;
 
-      variables[(int)op.data].data = a;
+    case OP_LE_ELSE:
+      FUSED_ELSE(<=);
       break;
 
-    case OP_GETL:
-      if (!stackPush(stack[frame + (int)op.data])) {
-        return 0;
-      }
+    case OP_EQ_ELSE:
+      FUSED_ELSE(==);
       break;
 
-    case OP_SETL:
-      if (!stackPop(&a)) {
-        return 0;
-      }
+    case OP_NE_ELSE:
+      FUSED_ELSE(!=);
+      break;
+
+    case OP_GTK_ELSE:
+      FUSED_ELSEK(>);
+      break;
+
+    case OP_GEK_ELSE:
+      FUSED_ELSEK(>=);
+      break;
+
+    case OP_LTK_ELSE:
+      FUSED_ELSEK(<);
+      break;
+
+    case OP_LEK_ELSE:
+      FUSED_ELSEK(<=);
+      break;
+
+    case OP_EQK_ELSE:
+      FUSED_ELSEK(==);
+      break;
+
+    case OP_NEK_ELSE:
+      FUSED_ELSEK(!=);
+      break;
+
+    case OP_INCL:
+      fp[op.data] += vm->consts[vm->ops[++i].data];
+      break;
 
-      stack[frame + (int)op.data] = a;
+    case OP_INCG:
+      vm->variables[op.data].data += vm->consts[vm->ops[++i].data];
+      break;
+
+    case OP_NATIVEL:
+      FUSED_NATIVEL();
       break;
     }
   }
@@ -1300,49 +2608,1387 @@ int elangRun(void) {
   return 1;
 }
 
-int elangCompile(char *data, int size) {
-  opsCount = 0;
-
-  functionsCount = nativesCount;
-  functionsLocal = 0;
+#ifdef ELANG_COMPUTED_GOTO
+// GCC merges the dispatches ending the handlers into a few shared jumps, which
+// predict the next handler much worse than one jump per handler
+#if defined(__GNUC__) && !defined(__clang__)
+#define THREADED_FUNCTION __attribute__((optimize("no-crossjumping")))
+#else
+#define THREADED_FUNCTION
+#endif
 
-  variablesMax = 0;
-  variablesBase = 0;
-  variablesCount = 0;
+#define THREADED_NEXT()                                                                            \
+  do {                                                                                             \
+    COUNT_DISPATCH();                                                                              \
+    goto *vm->opsLabels[++i];                                                                      \
+  } while (0)
 
-  lexerInit((Str){.data = data, .count = size});
+THREADED_FUNCTION int elangRunThreaded(ElangVM *vm) {
+  static void *labels[] = {
+    [OP_NUM] = &&op_num,       [OP_GT] = &&op_gt,         [OP_GE] = &&op_ge,
+    [OP_LT] = &&op_lt,         [OP_LE] = &&op_le,         [OP_EQ] = &&op_eq,
+    [OP_NE] = &&op_ne,         [OP_ADD] = &&op_add,       [OP_SUB] = &&op_sub,
+    [OP_MUL] = &&op_mul,       [OP_DIV] = &&op_div,       [OP_NOT] = &&op_not,
+    [OP_NEG] = &&op_neg,       [OP_ELSE] = &&op_else,     [OP_GOTO] = &&op_goto,
+    [OP_CALL] = &&op_call,     [OP_NATIVE] = &&op_native, [OP_RETURN] = &&op_return,
+    [OP_DROP] = &&op_drop,     [OP_GETG] = &&op_getg,     [OP_SETG] = &&op_setg,
+    [OP_GETL] = &&op_getl,     [OP_SETL] = &&op_setl,
+
+    [OP_GT_ELSE] = &&op_gt_else,   [OP_GE_ELSE] = &&op_ge_else,   [OP_LT_ELSE] = &&op_lt_else,
+    [OP_LE_ELSE] = &&op_le_else,   [OP_EQ_ELSE] = &&op_eq_else,   [OP_NE_ELSE] = &&op_ne_else,
+    [OP_GTK_ELSE] = &&op_gtk_else, [OP_GEK_ELSE] = &&op_gek_else, [OP_LTK_ELSE] = &&op_ltk_else,
+    [OP_LEK_ELSE] = &&op_lek_else, [OP_EQK_ELSE] = &&op_eqk_else, [OP_NEK_ELSE] = &&op_nek_else,
+    [OP_INCL] = &&op_incl,         [OP_INCG] = &&op_incg,         [OP_NATIVEL] = &&op_nativel,
+  };
 
-  Token token;
-  while (1) {
-    if (!lexerPeek(&token)) {
+  if (!vm->opsResolved) {
+    vm->opsLabels = ARENA_ARRAY(void *, vm->opsCount + 1);
+    if (!vm->opsLabels) {
       return 0;
     }
 
-    if (token.type == TOKEN_EOF) {
-      break;
-    }
-
-    if (!compileStmt()) {
-      return 0;
+    for (int i = 0; i < vm->opsCount; i += opsLength(vm, vm->ops[i])) {
+      vm->opsLabels[i] = labels[vm->ops[i].type];
     }
+    vm->opsLabels[vm->opsCount] = &&done;
+    vm->opsResolved = 1;
   }
 
-  return 1;
-}
+  float *sp = vm->stack;
+  float *fp = vm->stack;
+  float a;
 
-int elangRegisterNative(char *name, int arity, Native native) {
-  if (nativesCount >= PROGRAM_CAP) {
-    LOG_ERROR(STR("Natives overflow"));
-    return 0;
+  int i = -1;
+  THREADED_NEXT();
+
+op_num:
+  *sp++ = vm->consts[vm->ops[i].data];
+  THREADED_NEXT();
+
+op_gt:
+  BINARY_OP(>);
+  THREADED_NEXT();
+
+op_ge:
+  BINARY_OP(>=);
+  THREADED_NEXT();
+
+op_lt:
+  BINARY_OP(<);
+  THREADED_NEXT();
+
+op_le:
+  BINARY_OP(<=);
+  THREADED_NEXT();
+
+op_eq:
+  BINARY_OP(==);
+  THREADED_NEXT();
+
+op_ne:
+  BINARY_OP(!=);
+  THREADED_NEXT();
+
+op_add:
+  BINARY_OP(+);
+  THREADED_NEXT();
+
+op_sub:
+  BINARY_OP(-);
+  THREADED_NEXT();
+
+op_mul:
+  BINARY_OP(*);
+  THREADED_NEXT();
+
+op_div:
+  BINARY_OP(/);
+  THREADED_NEXT();
+
+op_not:
+  UNARY_OP(!);
+  THREADED_NEXT();
+
+op_neg:
+  UNARY_OP(-);
+  THREADED_NEXT();
+
+op_else:
+  if (!*--sp) {
+    i = vm->ops[i].data - 1;
   }
+  THREADED_NEXT();
 
-  Str str = {.data = name, .count = 0};
-  while (str.data[str.count] != '\0') {
-    str.count++;
+op_goto:
+  if (vm->ops[i].data <= i) {
+    BUDGET_STEP();
   }
+  i = vm->ops[i].data - 1;
+  THREADED_NEXT();
+
+op_call: {
+  Function *f = &vm->functions[vm->ops[i].data];
+  BUDGET_STEP();
+  CALL_CHECK(f);
+
+  sp += f->body - f->arity;
+  *sp++ = i;
+  *sp++ = fp - vm->stack;
+
+  fp = sp - f->body - 2;
+  i = f->start - 1;
+  THREADED_NEXT();
+}
 
-  natives[nativesCount++] = native;
-  return functionsPush(str, arity, -nativesCount);
+op_native: {
+  Function *f = &vm->functions[vm->ops[i].data];
+  sp -= f->arity;
+
+  a = vm->natives[-f->start - 1](vm, sp);
+  *sp++ = a;
+  THREADED_NEXT();
+}
+
+op_return: {
+  Function *f = &vm->functions[vm->ops[i].data];
+  a = *--sp;
+  fp = vm->stack + (int)*--sp;
+  i = *--sp;
+
+  sp -= f->body;
+  *sp++ = a;
+  THREADED_NEXT();
 }
 
+op_drop:
+  sp--;
+  THREADED_NEXT();
+
+op_getg:
+  *sp++ = vm->variables[vm->ops[i].data].data;
+  THREADED_NEXT();
+
+op_setg:
+  vm->variables[vm->ops[i].data].data = *--sp;
+  THREADED_NEXT();
+
+op_getl:
+  *sp++ = fp[vm->ops[i].data];
+  THREADED_NEXT();
+
+op_setl:
+  fp[vm->ops[i].data] = *--sp;
+  THREADED_NEXT();
+
+op_gt_else:
+  FUSED_ELSE(>);
+  THREADED_NEXT();
+
+op_ge_else:
+  FUSED_ELSE(>=);
+  THREADED_NEXT();
+
+op_lt_else:
+  FUSED_ELSE(<);
+  THREADED_NEXT();
+
+op_le_else:
+  FUSED_ELSE(<=);
+  THREADED_NEXT();
+
+op_eq_else:
+  FUSED_ELSE(==);
+  THREADED_NEXT();
+
+op_ne_else:
+  FUSED_ELSE(!=);
+  THREADED_NEXT();
+
+op_gtk_else:
+  FUSED_ELSEK(>);
+  THREADED_NEXT();
+
+op_gek_else:
+  FUSED_ELSEK(>=);
+  THREADED_NEXT();
+
+op_ltk_else:
+  FUSED_ELSEK(<);
+  THREADED_NEXT();
+
+op_lek_else:
+  FUSED_ELSEK(<=);
+  THREADED_NEXT();
+
+op_eqk_else:
+  FUSED_ELSEK(==);
+  THREADED_NEXT();
+
+op_nek_else:
+  FUSED_ELSEK(!=);
+  THREADED_NEXT();
+
+op_incl:
+  fp[vm->ops[i].data] += vm->consts[vm->ops[i + 1].data];
+  i++;
+  THREADED_NEXT();
+
+op_incg:
+  vm->variables[vm->ops[i].data].data += vm->consts[vm->ops[i + 1].data];
+  i++;
+  THREADED_NEXT();
+
+op_nativel:
+  FUSED_NATIVEL();
+  THREADED_NEXT();
+
+done:
+  return 1;
+}
+#endif
+
+#ifdef ELANG_REGISTER
+// Register
+int regsPush(ElangVM *vm, Reg reg) {
+  if (!ARENA_GROW(vm->regs, vm->regsCap, vm->regsCount)) {
+    return 0;
+  }
+
+  vm->regs[vm->regsCount++] = reg;
+  return 1;
+}
+
+int regsMove(ElangVM *vm, int dst, int src) {
+  if (dst == src) {
+    return 1;
+  }
+
+  return regsPush(vm, (Reg){.type = REG_MOV, .dst = dst, .a = src});
+}
+
+int regsIsConst(ElangVM *vm, int operand) {
+  return operand < 0 && -operand - 1 >= vm->regsGlobals;
+}
+
+int regsCompile(ElangVM *vm) {
+  vm->regsCount = 0;
+  vm->regsGlobals = 0;
+  for (int i = 0; i < vm->opsCount; i++) {
+    if ((vm->ops[i].type == OP_GETG || vm->ops[i].type == OP_SETG) &&
+        vm->regsGlobals <= vm->ops[i].data) {
+      vm->regsGlobals = vm->ops[i].data + 1;
+    }
+  }
+  vm->regsPoolCount = vm->regsGlobals;
+
+  vm->regs = 0;
+  vm->regsCap = 0;
+  vm->regsPool = 0;
+  vm->regsPoolCap = 0;
+  vm->regsAddr = ARENA_ARRAY(int, vm->opsCount + 1);
+  vm->regsValues = ARENA_ARRAY(int, vm->opsCount + 1);
+  if (!vm->regsAddr || !vm->regsValues ||
+      !ARENA_GROW(vm->regsPool, vm->regsPoolCap, vm->regsGlobals)) {
+    return 0;
+  }
+
+  int count = 0;
+  int base = 0;
+  int end = -1;
+  int next = vm->nativesCount;
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    vm->regsAddr[i] = vm->regsCount;
+
+    if (i == end) {
+      base = 0;
+      end = -1;
+    }
+
+    if (next < vm->functionsCount && i == vm->functions[next].start) {
+      base = vm->functions[next].body + 2;
+      end = vm->ops[i - 1].data;
+      next++;
+    }
+
+    Op op = vm->ops[i];
+    switch (op.type) {
+    case OP_NUM:
+      if (!ARENA_GROW(vm->regsPool, vm->regsPoolCap, vm->regsPoolCount)) {
+        return 0;
+      }
+      vm->regsPool[vm->regsPoolCount++] = vm->consts[op.data];
+      vm->regsValues[count++] = -vm->regsPoolCount;
+      break;
+
+    case OP_GETG:
+      vm->regsValues[count++] = -op.data - 1;
+      break;
+
+    case OP_GETL:
+      vm->regsValues[count++] = op.data;
+      break;
+
+    case OP_GT:
+    case OP_GE:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV: {
+      int b = vm->regsValues[--count];
+      int a = vm->regsValues[--count];
+      int dst = base + count;
+
+      Reg reg = {.type = REG_GT + op.type - OP_GT, .dst = dst, .a = a, .b = b};
+      if (regsIsConst(vm, b)) {
+        reg.type = REG_GTK + op.type - OP_GT;
+        reg.k = vm->regsPool[-b - 1];
+      }
+
+      if (!regsPush(vm, reg)) {
+        return 0;
+      }
+      vm->regsValues[count++] = dst;
+    } break;
+
+    case OP_NOT:
+    case OP_NEG: {
+      int a = vm->regsValues[--count];
+      int dst = base + count;
+
+      RegType type = op.type == OP_NOT ? REG_NOT : REG_NEG;
+      if (!regsPush(vm, (Reg){.type = type, .dst = dst, .a = a})) {
+        return 0;
+      }
+      vm->regsValues[count++] = dst;
+    } break;
+
+    case OP_ELSE: {
+      int a = vm->regsValues[--count];
+
+      // A compare into the temporary tested here branches by itself
+      Reg *last = vm->regsCount ? &vm->regs[vm->regsCount - 1] : 0;
+      if (a >= base && last && last->dst == a && last->type >= REG_GT && last->type <= REG_NE) {
+        last->type = REG_GT_ELSE + last->type - REG_GT;
+        last->dst = op.data;
+      } else if (a >= base && last && last->dst == a && last->type >= REG_GTK &&
+                 last->type <= REG_NEK) {
+        last->type = REG_GTK_ELSE + last->type - REG_GTK;
+        last->dst = op.data;
+      } else if (!regsPush(vm, (Reg){.type = REG_ELSE, .a = a, .b = op.data})) {
+        return 0;
+      }
+    } break;
+
+    case OP_GOTO:
+      if (!regsPush(vm, (Reg){.type = REG_GOTO, .b = op.data})) {
+        return 0;
+      }
+      break;
+
+    case OP_CALL:
+    case OP_NATIVE: {
+      Function *f = &vm->functions[op.data];
+      count -= f->arity;
+
+      // The callee may assign globals which are still pending as operands
+      if (op.type == OP_CALL) {
+        for (int j = 0; j < count; j++) {
+          if (vm->regsValues[j] < 0 && !regsIsConst(vm, vm->regsValues[j])) {
+            if (!regsMove(vm, base + j, vm->regsValues[j])) {
+              return 0;
+            }
+            vm->regsValues[j] = base + j;
+          }
+        }
+      }
+
+      // A native is passed a single argument, or arguments side by side in the
+      // frame, where they are
+      int args = base + count;
+      if (op.type == OP_NATIVE && f->arity) {
+        args = vm->regsValues[count];
+        for (int j = 1; j < f->arity; j++) {
+          if (args < 0 || vm->regsValues[count + j] != args + j) {
+            args = base + count;
+            break;
+          }
+        }
+      }
+
+      for (int j = 0; j < f->arity && args == base + count; j++) {
+        if (!regsMove(vm, base + count + j, vm->regsValues[count + j])) {
+          return 0;
+        }
+      }
+
+      RegType type = op.type == OP_CALL ? REG_CALL : REG_NATIVE;
+      if (!regsPush(vm, (Reg){.type = type, .dst = base + count, .a = op.data, .b = args})) {
+        return 0;
+      }
+      vm->regsValues[count] = base + count;
+      count++;
+    } break;
+
+    case OP_RETURN:
+      if (!regsPush(vm, (Reg){.type = REG_RETURN, .a = vm->regsValues[--count], .b = op.data})) {
+        return 0;
+      }
+      break;
+
+    case OP_DROP:
+      count--;
+      break;
+
+    case OP_SETG:
+    case OP_SETL: {
+      int dst = op.type == OP_SETG ? -op.data - 1 : op.data;
+      int value = vm->regsValues[--count];
+
+      Reg *last = vm->regsCount ? &vm->regs[vm->regsCount - 1] : 0;
+      if (value >= base && last && last->type <= REG_NEG && last->dst == value) {
+        last->dst = dst;
+      } else if (!regsMove(vm, dst, value)) {
+        return 0;
+      }
+    } break;
+
+    // Superinstructions are only made by opsFuse() for the stack interpreters
+    default:
+      return 0;
+    }
+  }
+  vm->regsAddr[vm->opsCount] = vm->regsCount;
+
+  for (int i = 0; i < vm->regsCount; i++) {
+    if (vm->regs[i].type == REG_ELSE || vm->regs[i].type == REG_GOTO) {
+      vm->regs[i].b = vm->regsAddr[vm->regs[i].b];
+    } else if (vm->regs[i].type >= REG_GT_ELSE && vm->regs[i].type <= REG_NEK_ELSE) {
+      vm->regs[i].dst = vm->regsAddr[vm->regs[i].dst];
+    }
+  }
+
+  return 1;
+}
+
+#define REG_LOAD(x) ((x) >= 0 ? fp[x] : vm->regsPool[-(x) - 1])
+#define REG_ADDR(x) ((x) >= 0 ? fp + (x) : vm->regsPool - (x) - 1)
+#define REG_STORE(x) *REG_ADDR(x)
+
+#define REG_UNARY_OP(op) REG_STORE(reg.dst) = op(REG_LOAD(reg.a))
+#define REG_BINARY_OP(op) REG_STORE(reg.dst) = REG_LOAD(reg.a) op REG_LOAD(reg.b)
+#define REG_BINARY_OPK(op) REG_STORE(reg.dst) = REG_LOAD(reg.a) op reg.k
+
+#define REG_BRANCH(op)                                                                             \
+  do {                                                                                             \
+    if (!(REG_LOAD(reg.a) op REG_LOAD(reg.b))) {                                                   \
+      i = reg.dst - 1;                                                                             \
+    }                                                                                              \
+  } while (0)
+
+#define REG_BRANCHK(op)                                                                            \
+  do {                                                                                             \
+    if (!(REG_LOAD(reg.a) op reg.k)) {                                                             \
+      i = reg.dst - 1;                                                                             \
+    }                                                                                              \
+  } while (0)
+
+int elangRunRegister(ElangVM *vm) {
+  for (int i = 0; i < vm->regsGlobals; i++) {
+    vm->regsPool[i] = vm->variables[i].data;
+  }
+
+  float *fp = vm->stack;
+  for (int i = 0; i < vm->regsCount; i++) {
+    COUNT_DISPATCH();
+
+    Reg reg = vm->regs[i];
+    switch (reg.type) {
+    case REG_MOV:
+      REG_STORE(reg.dst) = REG_LOAD(reg.a);
+      break;
+
+    case REG_GT:
+      REG_BINARY_OP(>);
+      break;
+
+    case REG_GE:
+      REG_BINARY_OP(>=);
+      break;
+
+    case REG_LT:
+      REG_BINARY_OP(<);
+      break;
+
+    case REG_LE:
+      REG_BINARY_OP(<=);
+      break;
+
+    case REG_EQ:
+      REG_BINARY_OP(==);
+      break;
+
+    case REG_NE:
+      REG_BINARY_OP(!=);
+      break;
+
+    case REG_ADD:
+      REG_BINARY_OP(+);
+      break;
+
+    case REG_SUB:
+      REG_BINARY_OP(-);
+      break;
+
+    case REG_MUL:
+      REG_BINARY_OP(*);
+      break;
+
+    case REG_DIV:
+      REG_BINARY_OP(/);
+      break;
+
+    case REG_GTK:
+      REG_BINARY_OPK(>);
+      break;
+
+    case REG_GEK:
+      REG_BINARY_OPK(>=);
+      break;
+
+    case REG_LTK:
+      REG_BINARY_OPK(<);
+      break;
+
+    case REG_LEK:
+      REG_BINARY_OPK(<=);
+      break;
+
+    case REG_EQK:
+      REG_BINARY_OPK(==);
+      break;
+
+    case REG_NEK:
+      REG_BINARY_OPK(!=);
+      break;
+
+    case REG_ADDK:
+      REG_BINARY_OPK(+);
+      break;
+
+    case REG_SUBK:
+      REG_BINARY_OPK(-);
+      break;
+
+    case REG_MULK:
+      REG_BINARY_OPK(*);
+      break;
+
+    case REG_DIVK:
+      REG_BINARY_OPK(/);
+      break;
+
+    case REG_NOT:
+      REG_UNARY_OP(!);
+      break;
+
+    case REG_NEG:
+      REG_UNARY_OP(-);
+      break;
+
+    case REG_ELSE:
+      if (!REG_LOAD(reg.a)) {
+        i = reg.b - 1;
+      }
+      break;
+
+    case REG_GT_ELSE:
+      REG_BRANCH(>);
+      break;
+
+    case REG_GE_ELSE:
+      REG_BRANCH(>=);
+      break;
+
+    case REG_LT_ELSE:
+      REG_BRANCH(<);
+      break;
+
+    case REG_LE_ELSE:
+      REG_BRANCH(<=);
+      break;
+
+    case REG_EQ_ELSE:
+      REG_BRANCH(==);
+      break;
+
+    case REG_NE_ELSE:
+      REG_BRANCH(!=);
+      break;
+
+    case REG_GTK_ELSE:
+      REG_BRANCHK(>);
+      break;
+
+    case REG_GEK_ELSE:
+      REG_BRANCHK(>=);
+      break;
+
+    case REG_LTK_ELSE:
+      REG_BRANCHK(<);
+      break;
+
+    case REG_LEK_ELSE:
+      REG_BRANCHK(<=);
+      break;
+
+    case REG_EQK_ELSE:
+      REG_BRANCHK(==);
+      break;
+
+    case REG_NEK_ELSE:
+      REG_BRANCHK(!=);
+      break;
+
+    case REG_GOTO:
+      if (reg.b <= i) {
+        BUDGET_STEP();
+      }
+      i = reg.b - 1;
+      break;
+
+    case REG_CALL: {
+      Function *f = &vm->functions[reg.a];
+      float *sp = fp + reg.dst + f->arity;
+      BUDGET_STEP();
+      CALL_CHECK(f);
+
+      float *frame = fp + reg.dst;
+      frame[f->body] = i;
+      frame[f->body + 1] = fp - vm->stack;
+
+      fp = frame;
+      i = vm->regsAddr[f->start] - 1;
+    } break;
+
+    case REG_NATIVE: {
+      Function *f = &vm->functions[reg.a];
+      fp[reg.dst] = vm->natives[-f->start - 1](vm, REG_ADDR(reg.b));
+    } break;
+
+    case REG_RETURN: {
+      Function *f = &vm->functions[reg.b];
+      float a = REG_LOAD(reg.a);
+
+      float *frame = fp;
+      i = frame[f->body];
+      fp = vm->stack + (int)frame[f->body + 1];
+      frame[0] = a;
+    } break;
+    }
+  }
+
+  for (int i = 0; i < vm->regsGlobals; i++) {
+    vm->variables[i].data = vm->regsPool[i];
+  }
+
+  return 1;
+}
+#endif
+
+#ifdef ELANG_JIT_X86_64
+#include "jit.h"
+#endif
+
+int elangVMRun(ElangVM *vm) {
+#ifdef ELANG_COUNT
+  vm->dispatched = 0;
+#endif
+
+  if (!stackGrow(vm, vm->opsDepthMax + 1)) {
+    return 0;
+  }
+  budgetStart(vm);
+
+#ifdef ELANG_JIT_X86_64
+  if (vm->jitReady) {
+    return jitRun(vm) && !vm->budgetFailed;
+  }
+#endif
+
+#if defined(ELANG_REGISTER)
+  int ok = elangRunRegister(vm);
+#elif defined(ELANG_COMPUTED_GOTO)
+  int ok = elangRunThreaded(vm);
+#else
+  int ok = elangRunSwitch(vm);
+#endif
+  return ok && !vm->budgetFailed;
+}
+
+// Forgets the compiled program and everything it allocated
+void programReset(ElangVM *vm) {
+  arenaRewind(vm);
+
+  vm->opsCount = 0;
+  vm->opsDepth = 0;
+  vm->opsDepthMax = 0;
+  vm->ops = 0;
+  vm->opsCap = 0;
+  vm->consts = 0;
+  vm->constsCount = 0;
+  vm->constsCap = 0;
+#ifdef ELANG_COMPUTED_GOTO
+  vm->opsResolved = 0;
+#endif
+#ifdef ELANG_REGISTER
+  vm->regsCount = 0;
+#endif
+#ifdef ELANG_JIT_X86_64
+  vm->jitReady = 0;
+#endif
+
+  vm->symbols = 0;
+  vm->symbolsCount = 0;
+  vm->symbolsCap = 0;
+  vm->symbolsTableCap = 0;
+
+  vm->functions = vm->functionsKept;
+  vm->functionsCap = vm->functionsKeptCap;
+  vm->functionsCount = vm->nativesCount;
+
+  vm->variables = 0;
+  vm->variablesCap = 0;
+  vm->variablesCount = 0;
+
+  vm->stack = 0;
+  vm->stackEnd = 0;
+  vm->stackCap = 0;
+}
+
+int compileProgram(ElangVM *vm, char *data, int size) {
+  programReset(vm);
+  if (!symbolsInit(vm, 64)) {
+    return 0;
+  }
+
+  for (int i = 0; i < vm->functionsCount; i++) {
+    if (!functionsBind(vm, i)) {
+      return 0;
+    }
+  }
+  vm->functionsLocal = 0;
+
+  vm->variablesMax = 0;
+  vm->variablesBase = 0;
+  vm->variablesCount = 0;
+
+  vm->cacheNext.entriesCount = 0;
+  vm->cacheNext.opsCount = 0;
+  vm->cacheNext.constsCount = 0;
+
+  lexerInit(vm, (Str){.data = data, .count = size});
+
+  Token token;
+  while (1) {
+    if (!lexerPeek(vm, &token)) {
+      return 0;
+    }
+
+    if (token.type == TOKEN_EOF) {
+      break;
+    }
+
+    if (!compileStmt(vm)) {
+      return 0;
+    }
+  }
+
+  if (vm->opsDepthMax > vm->stackLimit) {
+    LOG_ERROR(STR("Stack overflow"));
+    return 0;
+  }
+
+  // Only a program that compiled replaces the functions kept from the last one
+  Cache cache = vm->cache;
+  vm->cache = vm->cacheNext;
+  vm->cacheNext = cache;
+
+  return opsOptimize(vm);
+}
+
+#ifdef ELANG_AOT
+#include "aot.h"
+#endif
+
+// Translates the ops for the selected interpreter
+int programFinish(ElangVM *vm) {
+#ifdef ELANG_JIT_X86_64
+  if (jitCompile(vm)) {
+    return 1;
+  }
+#endif
+
+#if defined(ELANG_REGISTER)
+  return regsCompile(vm);
+#elif defined(ELANG_FUSE)
+  return opsFuse(vm);
+#else
+  return 1;
+#endif
+}
+
+int elangVMCompile(ElangVM *vm, char *data, int size) {
+  return compileProgram(vm, data, size) && programFinish(vm);
+}
+
+// Bytecode
+// A header, the ops before they are translated for an interpreter, their
+// constants, the function table, the initial values of the globals and the
+// function names. Every section is a multiple of four bytes but the last one.
+// The magic starts with a byte no source text starts with, like that of ELF.
+#define BYTECODE_MAGIC 0x424c457f // \x7fELB
+#define BYTECODE_VERSION 3
+
+typedef struct {
+  unsigned int magic;
+  int version;
+  int opSize;
+  int opTypes;
+  int opsCount;
+  int opsDepth;
+  int constsCount;
+  int functionsCount;
+  int nativesCount;
+  int globalsCount;
+  int namesSize;
+} BytecodeHeader;
+
+typedef struct {
+  int name;
+  int nameCount;
+  int arity;
+  int start;
+  int body;
+  int depth;
+} BytecodeFunction;
+
+int bytecodeGlobals(ElangVM *vm) {
+  int count = 0;
+  for (int i = 0; i < vm->opsCount; i++) {
+    if ((vm->ops[i].type == OP_GETG || vm->ops[i].type == OP_SETG) && count <= vm->ops[i].data) {
+      count = vm->ops[i].data + 1;
+    }
+  }
+  return count;
+}
+
+int bytecodeIndex(int data, int min, int max) {
+  return data >= min && data < max;
+}
+
+// The ops have to keep the layout the compiler gives them, which every
+// interpreter relies on. The top level starts at the first op, and a function
+// starts after a GOTO of the top level which skips its body. Every op is checked
+// at the depth the compiler counts with opsEffect(), against the limits and the
+// locals of its function, and a jump has to stay within the function and land
+// where the depth is the same.
+int bytecodeCheckOps(ElangVM *vm, BytecodeHeader *header) {
+  int *depths = ARENA_ARRAY(int, vm->opsCount + 1);
+  int *owners = ARENA_ARRAY(int, vm->opsCount + 1);
+  if (!depths || !owners) {
+    return 0;
+  }
+
+  int owner = -1;
+  int end = -1;
+  int next = vm->nativesCount;
+  int depth = 0;
+  int depthTop = 0;
+  for (int i = 0; i < vm->opsCount; i++) {
+    if (i == end) {
+      owner = -1;
+      depth = depthTop;
+    }
+
+    if (next < vm->functionsCount && i == vm->functions[next].start) {
+      if (i == 0 || owners[i - 1] != -1 || vm->ops[i - 1].type != OP_GOTO ||
+          (int)vm->ops[i - 1].data <= i) {
+        LOG_ERROR(STR("Invalid bytecode"));
+        return 0;
+      }
+
+      owner = next++;
+      end = vm->ops[i - 1].data;
+      depthTop = depth;
+      depth = 0;
+    }
+
+    Function *f = owner == -1 ? 0 : &vm->functions[owner];
+    Op op = vm->ops[i];
+    int ok = 1;
+    int need = 0;
+
+    switch (op.type) {
+    case OP_NUM:
+      ok = bytecodeIndex(op.data, 0, vm->constsCount);
+      break;
+
+    case OP_GT:
+    case OP_GE:
+    case OP_LT:
+    case OP_LE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+      need = 2;
+      break;
+
+    case OP_NOT:
+    case OP_NEG:
+    case OP_DROP:
+      need = 1;
+      break;
+
+    // Only a GOTO may jump back, the budget is taken there
+    case OP_ELSE:
+      ok = bytecodeIndex(op.data, i + 1, vm->opsCount + 1);
+      need = 1;
+      break;
+
+    case OP_GOTO:
+      ok = bytecodeIndex(op.data, 0, vm->opsCount + 1);
+      break;
+
+    case OP_CALL:
+      ok = bytecodeIndex(op.data, vm->nativesCount, vm->functionsCount);
+      need = ok ? vm->functions[op.data].arity : 0;
+      break;
+
+    case OP_NATIVE:
+      ok = bytecodeIndex(op.data, 0, vm->nativesCount);
+      need = ok ? vm->functions[op.data].arity : 0;
+      break;
+
+    // The frame is found right below the result
+    case OP_RETURN:
+      ok = f && (int)op.data == owner && depth == 1;
+      break;
+
+    case OP_GETG:
+    case OP_SETG:
+      ok = bytecodeIndex(op.data, 0, header->globalsCount);
+      need = op.type == OP_SETG;
+      break;
+
+    case OP_GETL:
+    case OP_SETL:
+      ok = f && bytecodeIndex(op.data, 0, f->body);
+      need = op.type == OP_SETL;
+      break;
+
+    default:
+      ok = 0;
+    }
+
+    // The last op of a function must not run on into the top level
+    if (f && i + 1 == end && op.type != OP_GOTO && op.type != OP_RETURN) {
+      ok = 0;
+    }
+
+    if (!ok || depth < need) {
+      LOG_ERROR(STR("Invalid bytecode"));
+      return 0;
+    }
+
+    depths[i] = depth;
+    owners[i] = owner;
+    depth += opsEffect(vm, op.type, op.data);
+    if (depth > (f ? f->depth : header->opsDepth)) {
+      LOG_ERROR(STR("Invalid bytecode"));
+      return 0;
+    }
+  }
+
+  if (next != vm->functionsCount) {
+    LOG_ERROR(STR("Invalid bytecode"));
+    return 0;
+  }
+  depths[vm->opsCount] = owner == -1 ? depth : depthTop;
+  owners[vm->opsCount] = -1;
+
+  for (int i = 0; i < vm->opsCount; i++) {
+    Op op = vm->ops[i];
+    if ((op.type == OP_ELSE || op.type == OP_GOTO) &&
+        (owners[op.data] != owners[i] ||
+         depths[op.data] != depths[i] + opsEffect(vm, op.type, op.data))) {
+      LOG_ERROR(STR("Invalid bytecode"));
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int elangVMSaveBytecode(ElangVM *vm, char *data, int size, ElangWrite write, void *context) {
+  if (!compileProgram(vm, data, size)) {
+    return 0;
+  }
+
+  BytecodeHeader header = {
+    .magic = BYTECODE_MAGIC,
+    .version = BYTECODE_VERSION,
+    .opSize = sizeof(Op),
+    .opTypes = OP_NATIVEL + 1,
+    .opsCount = vm->opsCount,
+    .opsDepth = vm->opsDepthMax,
+    .constsCount = vm->constsCount,
+    .functionsCount = vm->functionsCount,
+    .nativesCount = vm->nativesCount,
+    .globalsCount = bytecodeGlobals(vm),
+  };
+
+  for (int i = 0; i < vm->functionsCount; i++) {
+    header.namesSize += vm->functions[i].name.count;
+  }
+
+  write(context, &header, sizeof(header));
+  write(context, vm->ops, vm->opsCount * sizeof(Op));
+  write(context, vm->consts, vm->constsCount * sizeof(float));
+
+  int name = 0;
+  for (int i = 0; i < vm->functionsCount; i++) {
+    Function *f = &vm->functions[i];
+    BytecodeFunction entry = {
+      .name = name,
+      .nameCount = f->name.count,
+      .arity = f->arity,
+      .start = f->start,
+      .body = f->body,
+      .depth = f->depth,
+    };
+    write(context, &entry, sizeof(entry));
+    name += f->name.count;
+  }
+
+  for (int i = 0; i < header.globalsCount; i++) {
+    write(context, &vm->variables[i].data, sizeof(float));
+  }
+
+  for (int i = 0; i < vm->functionsCount; i++) {
+    write(context, vm->functions[i].name.data, vm->functions[i].name.count);
+  }
+
+  return programFinish(vm);
+}
+
+int elangIsBytecode(void *data, int size) {
+  unsigned char *bytes = data;
+  return size >= (int)sizeof(BytecodeHeader) && bytes[0] == 0x7f && bytes[1] == 'E' &&
+         bytes[2] == 'L' && bytes[3] == 'B';
+}
+
+int elangVMLoadBytecode(ElangVM *vm, void *data, int size) {
+  programReset(vm);
+
+  if (!elangIsBytecode(data, size) || (unsigned long)data % sizeof(float)) {
+    LOG_ERROR(STR("Invalid bytecode"));
+    return 0;
+  }
+
+  BytecodeHeader *header = data;
+  if (header->magic != BYTECODE_MAGIC || header->version != BYTECODE_VERSION ||
+      header->opSize != sizeof(Op) || header->opTypes != OP_NATIVEL + 1) {
+    LOG_ERROR(STR("Bytecode of another version"));
+    return 0;
+  }
+
+  long long total = sizeof(BytecodeHeader) + (long long)sizeof(Op) * header->opsCount +
+                    (long long)sizeof(float) * header->constsCount +
+                    (long long)sizeof(BytecodeFunction) * header->functionsCount +
+                    (long long)sizeof(float) * header->globalsCount + header->namesSize;
+
+  if (header->opsCount < 0 || header->opsCount > OPS_LIMIT || header->constsCount < 0 ||
+      header->functionsCount < 0 || header->globalsCount < 0 || header->namesSize < 0 ||
+      total != size) {
+    LOG_ERROR(STR("Invalid bytecode"));
+    return 0;
+  }
+
+  Op *ops = (Op *)(header + 1);
+  float *consts = (float *)(ops + header->opsCount);
+  BytecodeFunction *functions = (BytecodeFunction *)(consts + header->constsCount);
+  float *globals = (float *)(functions + header->functionsCount);
+  char *names = (char *)(globals + header->globalsCount);
+
+  if (header->nativesCount != vm->nativesCount || header->functionsCount < vm->nativesCount) {
+    LOG_ERROR(STR("Bytecode compiled with other natives"));
+    return 0;
+  }
+
+  vm->functions = ARENA_ARRAY(Function, header->functionsCount);
+  vm->variables = ARENA_ARRAY(Variable, header->globalsCount);
+  if ((header->functionsCount && !vm->functions) || (header->globalsCount && !vm->variables)) {
+    return 0;
+  }
+  vm->functionsCap = header->functionsCount;
+  vm->variablesCap = header->globalsCount;
+
+  for (int i = 0; i < header->functionsCount; i++) {
+    BytecodeFunction *f = &functions[i];
+    if (f->name < 0 || f->nameCount < 0 || f->name > header->namesSize - f->nameCount) {
+      LOG_ERROR(STR("Invalid bytecode"));
+      return 0;
+    }
+
+    Str name = {.data = names + f->name, .count = f->nameCount};
+    if (i < vm->nativesCount) {
+      Function *native = &vm->functionsKept[i];
+      if (!strEq(name, native->name) || f->arity != native->arity) {
+        LOG_ERROR(STR("Bytecode compiled with other natives"));
+        return 0;
+      }
+      vm->functions[i] = *native;
+      continue;
+    }
+
+    if (f->start < 0 || f->start > header->opsCount || f->arity < 0 || f->body < f->arity ||
+        f->depth < 0 || f->body + 2 + f->depth > vm->stackLimit) {
+      LOG_ERROR(STR("Invalid bytecode"));
+      return 0;
+    }
+
+    vm->functions[i] = (Function){
+      .name = name,
+      .symbol = -1,
+      .arity = f->arity,
+      .start = f->start,
+      .body = f->body,
+      .depth = f->depth,
+    };
+  }
+  vm->functionsCount = header->functionsCount;
+
+  for (int i = 0; i < header->globalsCount; i++) {
+    vm->variables[i] = (Variable){.symbol = -1, .data = globals[i]};
+  }
+  vm->variablesCount = header->globalsCount;
+
+  if (header->opsDepth < 0 || header->opsDepth > vm->stackLimit) {
+    LOG_ERROR(STR("Stack overflow"));
+    return 0;
+  }
+
+  vm->ops = ops;
+  vm->opsCount = header->opsCount;
+  vm->opsCap = header->opsCount;
+  vm->opsDepthMax = header->opsDepth;
+  vm->consts = consts;
+  vm->constsCount = header->constsCount;
+  vm->constsCap = header->constsCount;
+  if (!bytecodeCheckOps(vm, header)) {
+    return 0;
+  }
+
+  vm->opsMap = ARENA_ARRAY(int, vm->opsCount + 1);
+  vm->opsTarget = ARENA_ARRAY(char, vm->opsCount + 1);
+  if (!vm->opsMap || !vm->opsTarget) {
+    return 0;
+  }
+
+  return programFinish(vm);
+}
+
+int elangVMRegisterNative(ElangVM *vm, char *name, int arity, Native native) {
+  programReset(vm);
+  if (!ARENA_GROW(vm->natives, vm->nativesCap, vm->nativesCount)) {
+    return 0;
+  }
+
+  Str str = {.data = name, .count = 0};
+  while (str.data[str.count] != '\0') {
+    str.count++;
+  }
+
+  if (!functionsPush(vm, str, arity, -vm->nativesCount - 1)) {
+    return 0;
+  }
+  vm->natives[vm->nativesCount++] = native;
+
+  vm->functionsKept = vm->functions;
+  vm->functionsKeptCap = vm->functionsCap;
+  arenaKeep(vm);
+  return 1;
+}
+
+Native elangVMNative(ElangVM *vm, int index) {
+  return vm->natives[index];
+}
+
+unsigned long long elangVMHash(ElangVM *vm, char *data, int size) {
+  unsigned long long hash = HASH_BASIS;
+  if (vm->nativesCount) {
+    hash = vm->functionsKept[vm->nativesCount - 1].context;
+  }
+
+  for (int i = 0; i < vm->nativesCount; i++) {
+    unsigned long long address = (unsigned long)vm->natives[i];
+    hash = hashMix(hashMix(hash, address), address >> 32);
+  }
+
+  hash = hashMix(hashMix(hash, vm->arenaLimit), vm->stackLimit);
+  hash = hashMix(hashMix(hashMix(hash, vm->budgetFuel), vm->budgetFuel >> 32), vm->budgetTime);
+  return strHashFrom((Str){.data = data, .count = size}, hash);
+}
+
+void elangVMSetMemoryLimit(ElangVM *vm, int bytes) {
+  vm->arenaLimit = bytes;
+}
+
+void elangVMSetStackLimit(ElangVM *vm, int slots) {
+  vm->stackLimit = slots;
+}
+
+void elangVMSetFuel(ElangVM *vm, long long fuel) {
+  vm->budgetFuel = fuel > 0 ? fuel : 0;
+}
+
+void elangVMSetTimeLimit(ElangVM *vm, int milliseconds, ElangClock clock, void *context) {
+  vm->budgetTime = clock && milliseconds > 0 ? milliseconds : 0;
+  vm->budgetClock = vm->budgetTime ? clock : 0;
+  vm->budgetClockContext = context;
+}
+
+void elangVMFail(ElangVM *vm) {
+  vm->budgetFailed = 1;
+  vm->budgetSteps = 0;
+}
+
+int elangVMMemoryUsed(ElangVM *vm) {
+  return vm->arenaTotal - vm->arenaMark.total;
+}
+
+#ifdef ELANG_COUNT
+unsigned long elangVMDispatched(ElangVM *vm) {
+  return vm->dispatched;
+}
+#endif
+
+void vmInit(ElangVM *vm, ElangAllocator allocator, void *user) {
+  char *bytes = (char *)vm;
+  for (int i = 0; i < (int)sizeof(*vm); i++) {
+    bytes[i] = 0;
+  }
+
+  vm->user = user;
+  vm->arenaAllocator = allocator;
+  vm->arenaLimit = ELANG_MEMORY_LIMIT;
+  vm->stackLimit = ELANG_STACK_LIMIT;
+}
+
+ElangVM *elangVMCreate(ElangAllocator allocator, void *user) {
+  if (!allocator.alloc) {
+    return 0;
+  }
+
+  ElangVM *vm = allocator.alloc(allocator.context, sizeof(ElangVM));
+  if (vm) {
+    vmInit(vm, allocator, user);
+  }
+  return vm;
+}
+
+void elangVMDestroy(ElangVM *vm) {
+#ifdef ELANG_JIT_X86_64
+  jitFree(vm);
+#endif
+  arenaFree(vm);
+  cacheFree(vm, &vm->cache);
+  cacheFree(vm, &vm->cacheNext);
+  if (vm->arenaAllocator.free) {
+    vm->arenaAllocator.free(vm->arenaAllocator.context, vm);
+  }
+}
+
+void *elangVMUser(ElangVM *vm) {
+  return vm->user;
+}
+
+void elangVMSetUser(ElangVM *vm, void *user) {
+  vm->user = user;
+}
+
+// Default
+ElangVM vmDefault;
+int vmDefaultReady;
+
+ElangVM *elangDefault(void) {
+  if (!vmDefaultReady) {
+    vmInit(&vmDefault, (ElangAllocator){0}, 0);
+    vmDefaultReady = 1;
+  }
+  return &vmDefault;
+}
+
+int elangRun(void) {
+  return elangVMRun(elangDefault());
+}
+
+int elangCompile(char *data, int size) {
+  return elangVMCompile(elangDefault(), data, size);
+}
+
+int elangRegisterNative(char *name, int arity, Native native) {
+  return elangVMRegisterNative(elangDefault(), name, arity, native);
+}
+
+unsigned long long elangHash(char *data, int size) {
+  return elangVMHash(elangDefault(), data, size);
+}
+
+int elangSaveBytecode(char *data, int size, ElangWrite write, void *context) {
+  return elangVMSaveBytecode(elangDefault(), data, size, write, context);
+}
+
+int elangLoadBytecode(void *data, int size) {
+  return elangVMLoadBytecode(elangDefault(), data, size);
+}
+
+void elangSetAllocator(ElangAllocator allocator) {
+  elangDefault()->arenaAllocator = allocator;
+}
+
+void elangSetMemoryLimit(int bytes) {
+  elangVMSetMemoryLimit(elangDefault(), bytes);
+}
+
+void elangSetStackLimit(int slots) {
+  elangVMSetStackLimit(elangDefault(), slots);
+}
+
+void elangSetFuel(long long fuel) {
+  elangVMSetFuel(elangDefault(), fuel);
+}
+
+void elangSetTimeLimit(int milliseconds, ElangClock clock, void *context) {
+  elangVMSetTimeLimit(elangDefault(), milliseconds, clock, context);
+}
+
+int elangMemoryUsed(void) {
+  return elangVMMemoryUsed(elangDefault());
+}
+
+#ifdef ELANG_AOT
+int elangEmitC(char *data, int size, FILE *file) {
+  return elangVMEmitC(elangDefault(), data, size, file);
+}
+#endif
+
 #endif
@@ -0,0 +1,447 @@
+#ifndef JIT_H
+#define JIT_H
+
+// x86-64 backend for elang, included by elang.h when ELANG_JIT is defined.
+// The generated code keeps the frame layout of the stack VM:
+//   rbx = sp, r12 = fp, r13 = variables, r14 = start of the VM stack,
+//   r15 = end of the VM stack
+// Elang calls use the native call/ret, and the caller's fp is saved as an
+// offset in the two stack slots the VM would use for the return address and
+// frame, so the VM stack can move when it grows.
+
+#include <sys/mman.h>
+
+#define JIT_OP_SIZE 96
+
+void jitByte(ElangVM *vm, int byte) {
+  if (vm->jitSize >= vm->jitCodeCap) {
+    vm->jitFailed = 1;
+    return;
+  }
+  vm->jitCode[vm->jitSize++] = byte;
+}
+
+void jitBytes(ElangVM *vm, char *bytes, int count) {
+  for (int i = 0; i < count; i++) {
+    jitByte(vm, (unsigned char)bytes[i]);
+  }
+}
+
+void jitInt(ElangVM *vm, int value) {
+  for (int i = 0; i < 4; i++) {
+    jitByte(vm, (value >> (i * 8)) & 0xff);
+  }
+}
+
+void jitLong(ElangVM *vm, void *value) {
+  unsigned long bits = (unsigned long)value;
+  for (int i = 0; i < 8; i++) {
+    jitByte(vm, (bits >> (i * 8)) & 0xff);
+  }
+}
+
+void jitRex(ElangVM *vm, int w, int reg, int base) {
+  int rex = 0x40 | w << 3 | (reg >> 3) << 2 | base >> 3;
+  if (rex != 0x40) {
+    jitByte(vm, rex);
+  }
+}
+
+// [base + disp32] operand, r12 as a base needs a SIB byte
+void jitModrm(ElangVM *vm, int reg, int base, int disp) {
+  jitByte(vm, 0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == 4) {
+    jitByte(vm, 0x24);
+  }
+  jitInt(vm, disp);
+}
+
+#define RAX 0
+#define RCX 1
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R15 15
+
+// movss, addss, subss, mulss, divss between xmm0 and memory
+void jitSse(ElangVM *vm, int opcode, int xmm, int base, int disp) {
+  jitByte(vm, 0xf3);
+  jitRex(vm, 0, xmm, base);
+  jitByte(vm, 0x0f);
+  jitByte(vm, opcode);
+  jitModrm(vm, xmm, base, disp);
+}
+
+void jitUcomiss(ElangVM *vm, int xmm, int base, int disp) {
+  jitRex(vm, 0, xmm, base);
+  jitBytes(vm, "\x0f\x2e", 2);
+  jitModrm(vm, xmm, base, disp);
+}
+
+void jitMov(ElangVM *vm, int w, int opcode, int reg, int base, int disp) {
+  jitRex(vm, w, reg, base);
+  jitByte(vm, opcode);
+  jitModrm(vm, reg, base, disp);
+}
+
+void jitAddRbx(ElangVM *vm, int value) {
+  jitBytes(vm, "\x48\x81\xc3", 3);
+  jitInt(vm, value);
+}
+
+void jitPatch(ElangVM *vm, int at, int target) {
+  int offset = target - at - 4;
+  for (int i = 0; i < 4; i++) {
+    vm->jitCode[at + i] = (offset >> (i * 8)) & 0xff;
+  }
+}
+
+void jitJump(ElangVM *vm, char *opcode, int count, int target, int entry) {
+  jitBytes(vm, opcode, count);
+  if (!ARENA_GROW(vm->jitPatches, vm->jitPatchesCap, vm->jitPatchesCount)) {
+    vm->jitFailed = 1;
+    return;
+  }
+
+  vm->jitPatches[vm->jitPatchesCount++] =
+    (JitPatch){.at = vm->jitSize, .target = target, .entry = entry};
+  jitInt(vm, 0);
+}
+
+// Turns the flags of a ucomiss into 0.0 or 1.0 in eax
+void jitSetcc(ElangVM *vm, int cc, int extra, int join) {
+  jitBytes(vm, "\x0f", 1);
+  jitByte(vm, 0x90 | cc);
+  jitByte(vm, 0xc0);
+
+  if (extra >= 0) {
+    jitBytes(vm, "\x0f", 1);
+    jitByte(vm, 0x90 | extra);
+    jitByte(vm, 0xc1);
+    jitByte(vm, join);
+    jitByte(vm, 0xc8);
+  }
+
+  jitBytes(vm, "\x0f\xb6\xc0\x69\xc0\x00\x00\x80\x3f", 9);
+}
+
+#define CC_P 0xa
+#define CC_NP 0xb
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_AE 0x3
+
+#define JOIN_AND 0x20
+#define JOIN_OR 0x08
+
+void jitCompare(ElangVM *vm, OpType type) {
+  int swap = type == OP_LT || type == OP_LE;
+  jitSse(vm, 0x10, 0, RBX, swap ? -4 : -8);
+  jitUcomiss(vm, 0, RBX, swap ? -8 : -4);
+
+  switch (type) {
+  case OP_GT:
+  case OP_LT:
+    jitSetcc(vm, CC_A, -1, 0);
+    break;
+
+  case OP_GE:
+  case OP_LE:
+    jitSetcc(vm, CC_AE, -1, 0);
+    break;
+
+  case OP_EQ:
+    jitSetcc(vm, CC_E, CC_NP, JOIN_AND);
+    break;
+
+  default:
+    jitSetcc(vm, CC_NE, CC_P, JOIN_OR);
+    break;
+  }
+
+  jitMov(vm, 0, 0x89, RAX, RBX, -8);
+  jitAddRbx(vm, -4);
+}
+
+// Called with the stack slots a call needs, returns the new start of the stack
+float *jitGrow(ElangVM *vm, int count) {
+  return stackGrow(vm, count) ? vm->stack : 0;
+}
+
+// Takes a step from the budget, the check runs once the steps are used up
+void jitBudget(ElangVM *vm) {
+  jitBytes(vm, "\x48\xb8", 2);
+  jitLong(vm, &vm->budgetSteps);
+  jitBytes(vm, "\xff\x08\x79\x05\xe8", 5);
+  jitInt(vm, vm->jitBudgetAt - vm->jitSize - 4);
+}
+
+int jitOp(ElangVM *vm, int i) {
+  Op op = vm->ops[i];
+  switch (op.type) {
+  case OP_NUM: {
+    union {
+      float f;
+      int i;
+    } bits = {.f = vm->consts[op.data]};
+
+    jitRex(vm, 0, 0, RBX);
+    jitByte(vm, 0xc7);
+    jitModrm(vm, 0, RBX, 0);
+    jitInt(vm, bits.i);
+    jitAddRbx(vm, 4);
+  } break;
+
+  case OP_GT:
+  case OP_GE:
+  case OP_LT:
+  case OP_LE:
+  case OP_EQ:
+  case OP_NE:
+    jitCompare(vm, op.type);
+    break;
+
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV: {
+    int opcodes[] = {[OP_ADD] = 0x58, [OP_SUB] = 0x5c, [OP_MUL] = 0x59, [OP_DIV] = 0x5e};
+    jitSse(vm, 0x10, 0, RBX, -8);
+    jitSse(vm, opcodes[op.type], 0, RBX, -4);
+    jitSse(vm, 0x11, 0, RBX, -8);
+    jitAddRbx(vm, -4);
+  } break;
+
+  case OP_NOT:
+    jitSse(vm, 0x10, 0, RBX, -4);
+    jitBytes(vm, "\x0f\x57\xc9\x0f\x2e\xc1", 6);
+    jitSetcc(vm, CC_E, CC_NP, JOIN_AND);
+    jitMov(vm, 0, 0x89, RAX, RBX, -4);
+    break;
+
+  case OP_NEG:
+    jitRex(vm, 0, 0, RBX);
+    jitByte(vm, 0x81);
+    jitModrm(vm, 6, RBX, -4);
+    jitInt(vm, 0x80000000);
+    break;
+
+  case OP_ELSE:
+    jitAddRbx(vm, -4);
+    jitSse(vm, 0x10, 0, RBX, 0);
+    jitBytes(vm, "\x0f\x57\xc9\x0f\x2e\xc1\x7a\x06", 8);
+    jitJump(vm, "\x0f\x84", 2, op.data, 0);
+    break;
+
+  case OP_GOTO:
+    if (op.data <= i) {
+      jitBudget(vm);
+    }
+    jitJump(vm, "\xe9", 1, op.data, 0);
+    break;
+
+  case OP_CALL: {
+    int index = op.data;
+    Function *f = &vm->functions[index];
+
+    jitBudget(vm);
+    jitMov(vm, 1, 0x8d, RAX, RBX, (f->body - f->arity + 2 + f->depth) * 4);
+    jitBytes(vm, "\x4c\x39\xf8\x76\x05\xe8", 6);
+    jitInt(vm, vm->jitGrowAt - vm->jitSize - 4);
+
+    jitAddRbx(vm, (f->body - f->arity) * 4);
+    jitBytes(vm, "\x4c\x89\xe0\x4c\x29\xf0", 6);
+    jitMov(vm, 1, 0x89, RAX, RBX, 0);
+    jitAddRbx(vm, 8);
+    jitMov(vm, 1, 0x8d, R12, RBX, -(f->body + 2) * 4);
+    jitJump(vm, "\xe8", 1, index, 1);
+  } break;
+
+  case OP_NATIVE: {
+    Function *f = &vm->functions[op.data];
+
+    jitMov(vm, 1, 0x8d, RSI, RBX, -f->arity * 4);
+    jitBytes(vm, "\x48\x89\xf3\x48\xbf", 5);
+    jitLong(vm, vm);
+    jitBytes(vm, "\x48\xb8", 2);
+    jitLong(vm, vm->natives[-f->start - 1]);
+    jitBytes(vm, "\xff\xd0", 2);
+    jitSse(vm, 0x11, 0, RBX, 0);
+    jitAddRbx(vm, 4);
+  } break;
+
+  case OP_RETURN: {
+    Function *f = &vm->functions[op.data];
+
+    jitSse(vm, 0x10, 0, RBX, -4);
+    jitBytes(vm, "\x4c\x89\xe3", 3);
+    jitMov(vm, 1, 0x8b, R12, RBX, f->body * 4);
+    jitBytes(vm, "\x4d\x01\xf4", 3);
+    jitSse(vm, 0x11, 0, RBX, 0);
+    jitAddRbx(vm, 4);
+    jitBytes(vm, "\x48\x83\xc4\x08\xc3", 5);
+  } break;
+
+  case OP_DROP:
+    jitAddRbx(vm, -4);
+    break;
+
+  case OP_GETG:
+  case OP_GETL:
+    if (op.type == OP_GETG) {
+      jitMov(vm, 0, 0x8b, RAX, R13, (char *)&vm->variables[op.data].data - (char *)vm->variables);
+    } else {
+      jitMov(vm, 0, 0x8b, RAX, R12, op.data * 4);
+    }
+    jitMov(vm, 0, 0x89, RAX, RBX, 0);
+    jitAddRbx(vm, 4);
+    break;
+
+  case OP_SETG:
+  case OP_SETL:
+    jitAddRbx(vm, -4);
+    jitMov(vm, 0, 0x8b, RAX, RBX, 0);
+    if (op.type == OP_SETG) {
+      jitMov(vm, 0, 0x89, RAX, R13, (char *)&vm->variables[op.data].data - (char *)vm->variables);
+    } else {
+      jitMov(vm, 0, 0x89, RAX, R12, op.data * 4);
+    }
+    break;
+
+  default:
+    return 0;
+  }
+
+  return 1;
+}
+
+int jitCompile(ElangVM *vm) {
+  vm->jitReady = 0;
+  vm->jitFailed = 0;
+
+  int cap = vm->opsCount * JIT_OP_SIZE + 512;
+  if (vm->jitCode && vm->jitCodeCap < cap) {
+    munmap(vm->jitCode, vm->jitCodeCap);
+    vm->jitCode = 0;
+  }
+
+  if (!vm->jitCode) {
+    void *code = mmap(0, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+      return 0;
+    }
+    vm->jitCode = code;
+    vm->jitCodeCap = cap;
+  } else if (mprotect(vm->jitCode, vm->jitCodeCap, PROT_READ | PROT_WRITE)) {
+    return 0;
+  }
+
+  vm->jitAddr = ARENA_ARRAY(int, vm->opsCount + 1);
+  vm->jitEntry = ARENA_ARRAY(int, vm->functionsCount);
+  if (!vm->jitAddr || !vm->jitEntry) {
+    return 0;
+  }
+
+  vm->jitSize = 0;
+  vm->jitPatches = 0;
+  vm->jitPatchesCount = 0;
+  vm->jitPatchesCap = 0;
+
+  // push rbx, r12-r15, remember rsp for unwinding and load the VM registers
+  jitBytes(vm, "\x53\x41\x54\x41\x55\x41\x56\x41\x57\x48\xb8", 11);
+  jitLong(vm, &vm->jitRsp);
+  jitBytes(vm, "\x48\x89\x20\x48\xb8", 5);
+  jitLong(vm, &vm->stack);
+  jitBytes(vm, "\x4c\x8b\x30\x4c\x89\xf3\x4d\x89\xf4\x49\xbd", 11);
+  jitLong(vm, vm->variables);
+  jitBytes(vm, "\x48\xb8", 2);
+  jitLong(vm, &vm->stackEnd);
+  jitBytes(vm, "\x4c\x8b\x38\xe9", 4);
+  int skip = vm->jitSize;
+  jitInt(vm, 0);
+
+  // Not enough room for a call, grow the stack and rebase sp, fp and its end
+  vm->jitGrowAt = vm->jitSize;
+  jitBytes(vm, "\x4c\x29\xf0\x4c\x29\xf3\x4d\x29\xf4\x48\x89\xc6\x48\xc1\xee\x02", 16);
+  jitBytes(vm, "\x48\xbf", 2);
+  jitLong(vm, vm);
+  jitBytes(vm, "\x48\x83\xec\x08\x48\xb8", 6);
+  jitLong(vm, jitGrow);
+  jitBytes(vm, "\xff\xd0\x48\x83\xc4\x08\x48\x85\xc0\x0f\x84", 11);
+  int overflow = vm->jitSize;
+  jitInt(vm, 0);
+  jitBytes(vm, "\x49\x89\xc6\x4c\x01\xf3\x4d\x01\xf4\x48\xb8", 11);
+  jitLong(vm, &vm->stackEnd);
+  jitBytes(vm, "\x4c\x8b\x38\xc3", 4);
+
+  // Out of steps, check the budget
+  vm->jitBudgetAt = vm->jitSize;
+  jitBytes(vm, "\x48\xbf", 2);
+  jitLong(vm, vm);
+  jitBytes(vm, "\x48\x83\xec\x08\x48\xb8", 6);
+  jitLong(vm, budgetCheck);
+  jitBytes(vm, "\xff\xd0\x48\x83\xc4\x08\x85\xc0\x0f\x84", 10);
+  int exhausted = vm->jitSize;
+  jitInt(vm, 0);
+  jitByte(vm, 0xc3);
+
+  // Stack overflow or out of budget, unwind to the entry and return 0
+  vm->jitOverflowAt = vm->jitSize;
+  jitBytes(vm, "\x48\xb8", 2);
+  jitLong(vm, &vm->jitRsp);
+  jitBytes(vm, "\x48\x8b\x20\x31\xc0\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3", 15);
+
+  if (vm->jitFailed) {
+    return 0;
+  }
+  jitPatch(vm, skip, vm->jitSize);
+  jitPatch(vm, overflow, vm->jitOverflowAt);
+  jitPatch(vm, exhausted, vm->jitOverflowAt);
+
+  int next = vm->nativesCount;
+  for (int i = 0; i < vm->opsCount; i++) {
+    if (next < vm->functionsCount && vm->functions[next].start == i) {
+      vm->jitEntry[next++] = vm->jitSize;
+      jitBytes(vm, "\x48\x83\xec\x08", 4);
+    }
+
+    vm->jitAddr[i] = vm->jitSize;
+    if (!jitOp(vm, i)) {
+      return 0;
+    }
+  }
+  vm->jitAddr[vm->opsCount] = vm->jitSize;
+
+  jitBytes(vm, "\xb8\x01\x00\x00\x00\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3", 15);
+  if (vm->jitFailed) {
+    return 0;
+  }
+
+  for (int i = 0; i < vm->jitPatchesCount; i++) {
+    JitPatch patch = vm->jitPatches[i];
+    jitPatch(vm, patch.at, patch.entry ? vm->jitEntry[patch.target] : vm->jitAddr[patch.target]);
+  }
+
+  if (mprotect(vm->jitCode, vm->jitCodeCap, PROT_READ | PROT_EXEC)) {
+    return 0;
+  }
+
+  vm->jitReady = 1;
+  return 1;
+}
+
+int jitRun(ElangVM *vm) {
+  return ((int (*)(void))vm->jitCode)();
+}
+
+void jitFree(ElangVM *vm) {
+  if (vm->jitCode) {
+    munmap(vm->jitCode, vm->jitCodeCap);
+    vm->jitCode = 0;
+  }
+}
+
+#endif
@@ -1,58 +1,375 @@
+#include "batch.h"
+#include "elang.h"
 #include "pen.h"
+#include "svg.h"
 #include <raylib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 void platformClear(void) {
   ClearBackground(RAYWHITE);
 }
 
 void platformErrorStart(void) {
+  if (batchActive()) {
+    batchErrorStart();
+    return;
+  }
   fprintf(stderr, "ERROR: ");
 }
 
 void platformErrorPush(char *data, int count) {
+  if (batchActive()) {
+    batchErrorPush(data, count);
+    return;
+  }
   fwrite(data, count, 1, stderr);
 }
 
 void platformErrorEnd(void) {
-  fputc('\n', stderr);
+  if (!batchActive()) {
+    fputc('\n', stderr);
+  }
+}
+
+void platformDrawLines(float *points, int count) {
+  DrawLineStrip((Vector2 *)points, count, BLACK);
+}
+
+void update(char *file_path) {
+#ifdef PEN_AOT
+  penUpdateProgram(elangProgram);
+#else
+  char *data = LoadFileText(file_path);
+  if (data) {
+    penUpdate(data, strlen(data));
+    UnloadFileText(data);
+
+#ifdef ELANG_COUNT
+    printf("Dispatched %lu instructions\n", elangVMDispatched(elangDefault()));
+#endif
+  }
+#endif
+}
+
+// Watch
+// The script is run again as soon as it is saved. Editors often save by writing
+// a new file over the old one, so its directory is watched instead of the file.
+typedef struct {
+  int fd;
+  char *name;
+} Watch;
+
+int watchInit(Watch *watch, char *file_path) {
+  watch->fd = -1;
+#if defined(__linux__) && !defined(PEN_AOT)
+  char *slash = strrchr(file_path, '/');
+  watch->name = slash ? slash + 1 : file_path;
+
+  char dir[4096] = ".";
+  if (slash) {
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - file_path) + 1, file_path);
+  }
+
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd >= 0 && inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(watch->fd);
+    watch->fd = -1;
+  }
+#endif
+  return watch->fd >= 0;
+}
+
+// Drains the pending events, without waiting for more
+int watchChanged(Watch *watch) {
+  int changed = 0;
+#if defined(__linux__) && !defined(PEN_AOT)
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    int count = read(watch->fd, buffer, sizeof(buffer));
+    if (count <= 0) {
+      break;
+    }
+
+    for (int i = 0; i < count;) {
+      struct inotify_event *event = (struct inotify_event *)(buffer + i);
+      if (event->len && !strcmp(event->name, watch->name)) {
+        changed = 1;
+      }
+      i += sizeof(struct inotify_event) + event->len;
+    }
+  }
+#endif
+  return changed;
 }
 
-void platformDrawLine(int x1, int y1, int x2, int y2) {
-  DrawLine(x1, y1, x2, y2, BLACK);
+#ifdef ELANG_AOT
+int emit(char *file_path) {
+  SetTraceLogLevel(LOG_WARNING);
+
+  char *data = LoadFileText(file_path);
+  if (!data) {
+    return 1;
+  }
+
+  penInit();
+  int ok = elangEmitC(data, strlen(data), stdout);
+  UnloadFileText(data);
+  return !ok;
+}
+#endif
+
+void compileWrite(void *file, void *data, int size) {
+  fwrite(data, 1, size, file);
+}
+
+int compile(char *output, char *file_path) {
+  SetTraceLogLevel(LOG_WARNING);
+
+  char *data = LoadFileText(file_path);
+  if (!data) {
+    return 1;
+  }
+
+  FILE *file = fopen(output, "wb");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not create '%s'\n", output);
+    UnloadFileText(data);
+    return 1;
+  }
+
+  penInit();
+  int ok = elangSaveBytecode(data, strlen(data), compileWrite, file);
+  int written = !ferror(file);
+  if ((fclose(file) || !written) && ok) {
+    fprintf(stderr, "ERROR: could not write '%s'\n", output);
+    ok = 0;
+  }
+
+  if (!ok) {
+    remove(output);
+  }
+
+  UnloadFileText(data);
+  return !ok;
+}
+
+int export(char *output, char *file_path) {
+  SetTraceLogLevel(LOG_WARNING);
+
+  char *data = LoadFileText(file_path);
+  if (!data) {
+    return 1;
+  }
+
+  static Svg svg;
+  Pen *pen = penCreate();
+  if (!pen) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    UnloadFileText(data);
+    return 1;
+  }
+
+  if (!svgOpen(&svg, output)) {
+    fprintf(stderr, "ERROR: could not create '%s'\n", output);
+    penDestroy(pen);
+    UnloadFileText(data);
+    return 1;
+  }
+
+  // The canvas is written while the script runs
+  penStream(pen, svgPoints, &svg);
+  int ok = penCompile(pen, data, strlen(data)) && penRun(pen);
+  if (!svgClose(&svg) && ok) {
+    fprintf(stderr, "ERROR: could not write '%s'\n", output);
+    ok = 0;
+  }
+
+  // A broken file is removed, but not a pipe, device or link written through
+  struct stat info;
+  if (!ok && !lstat(output, &info) && S_ISREG(info.st_mode)) {
+    remove(output);
+  }
+
+  penDestroy(pen);
+  UnloadFileText(data);
+  return !ok;
 }
 
 int main(int argc, char **argv) {
+  int simplify = 0;
+#ifdef PEN_AOT
+  char *file_path = 0;
+#else
   if (argc < 2) {
     fprintf(stderr, "ERROR: file path not provided\n");
-    fprintf(stderr, "USAGE: %s <file>\n", *argv);
+    fprintf(stderr, "USAGE: %s <file> [--simplify]\n", *argv);
+    fprintf(stderr, "       %s --batch <dir> --out <dir> [--jobs <n>] [--smooth]\n", *argv);
+    fprintf(stderr, "           [--fuel <n>] [--time-limit <ms>]\n");
+    fprintf(stderr, "       %s --export-svg <out> <file>\n", *argv);
+    fprintf(stderr, "       %s --compile <out> <file>\n", *argv);
+#ifdef ELANG_AOT
+    fprintf(stderr, "       %s --emit-c <file>\n", *argv);
+#endif
     return 1;
   }
   char *file_path = argv[1];
 
+  if (!strcmp(file_path, "--batch")) {
+    if (argc < 5 || strcmp(argv[3], "--out")) {
+      fprintf(stderr, "ERROR: input and output directories not provided\n");
+      return 1;
+    }
+
+    int jobs = 0;
+    int smooth = 0;
+    long long fuel = 0;
+    int timeLimit = 0;
+    for (int i = 5; i < argc; i++) {
+      if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+        jobs = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "--smooth")) {
+        smooth = 1;
+      } else if (!strcmp(argv[i], "--fuel") && i + 1 < argc) {
+        fuel = atoll(argv[++i]);
+      } else if (!strcmp(argv[i], "--time-limit") && i + 1 < argc) {
+        timeLimit = atoi(argv[++i]);
+      } else {
+        fprintf(stderr, "ERROR: unknown option '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    return batchMain(argv[2], argv[4], jobs, smooth, fuel, timeLimit);
+  }
+
+  if (!strcmp(file_path, "--export-svg")) {
+    if (argc < 4) {
+      fprintf(stderr, "ERROR: output and file path not provided\n");
+      return 1;
+    }
+    return export(argv[2], argv[3]);
+  }
+
+  if (!strcmp(file_path, "--compile")) {
+    if (argc < 4) {
+      fprintf(stderr, "ERROR: output and file path not provided\n");
+      return 1;
+    }
+    return compile(argv[2], argv[3]);
+  }
+
+#ifdef ELANG_AOT
+  if (!strcmp(file_path, "--emit-c")) {
+    if (argc < 3) {
+      fprintf(stderr, "ERROR: file path not provided\n");
+      return 1;
+    }
+    return emit(argv[2]);
+  }
+#endif
+
+  if (argc > 2) {
+    if (strcmp(argv[2], "--simplify")) {
+      fprintf(stderr, "ERROR: unknown option '%s'\n", argv[2]);
+      return 1;
+    }
+    simplify = 1;
+  }
+#endif
+
   SetConfigFlags(FLAG_WINDOW_RESIZABLE);
   InitWindow(800, 600, "Pen");
   penInit();
-
-  char *data = LoadFileText(file_path);
-  if (data) {
-    penUpdate(data, strlen(data));
-    UnloadFileText(data);
+  if (simplify && !penSimplify(1)) {
+    fprintf(stderr, "ERROR: out of memory\n");
   }
 
+  update(file_path);
+
+  // Without a watcher the script is run again with R
+  Watch watch;
+  int watching = watchInit(&watch, file_path);
+
+  // The canvas is rendered into a texture, which is only redrawn when the
+  // script is run again, the window is resized or the view moves
+  RenderTexture2D target = {0};
+  int generation = 0;
+  int width = 0;
+  int height = 0;
+
+  float viewX = 0;
+  float viewY = 0;
+  float scale = 1;
+
   while (!WindowShouldClose()) {
+    int w = GetScreenWidth();
+    int h = GetScreenHeight();
+
+    // Dragging pans the canvas and the wheel zooms around the cursor
+    Vector2 drag = IsMouseButtonDown(MOUSE_BUTTON_LEFT) ? GetMouseDelta() : (Vector2){0};
+    float wheel = GetMouseWheelMove();
+    if (drag.x || drag.y || wheel) {
+      Vector2 mouse = GetMousePosition();
+      float x = viewX + (mouse.x - w / 2 - drag.x) / scale;
+      float y = viewY + (mouse.y - h / 2 - drag.y) / scale;
+      scale *= wheel > 0 ? 1.25 : wheel < 0 ? 0.8 : 1;
+      viewX = x - (mouse.x - w / 2) / scale;
+      viewY = y - (mouse.y - h / 2) / scale;
+      penView(viewX, viewY, scale);
+      generation = penGeneration() - 1;
+    }
+
+    if (IsKeyPressed(KEY_ZERO)) {
+      viewX = 0;
+      viewY = 0;
+      scale = 1;
+      penView(viewX, viewY, scale);
+      generation = penGeneration() - 1;
+    }
+    if (w != width || h != height) {
+      UnloadRenderTexture(target);
+      target = LoadRenderTexture(w, h);
+      width = w;
+      height = h;
+      generation = penGeneration() - 1;
+    }
+
+    if (generation != penGeneration()) {
+      generation = penGeneration();
+      BeginTextureMode(target);
+      penRender(w, h);
+      EndTextureMode();
+
+      if (simplify) {
+        int in, out;
+        penRenderStats(&in, &out);
+        printf("Drew %d of %d segments\n", out, in);
+      }
+    }
+
+    // Render textures are upside down
     BeginDrawing();
-    penRender(GetScreenWidth(), GetScreenHeight());
+    DrawTextureRec(target.texture, (Rectangle){0, 0, w, -h}, (Vector2){0, 0}, WHITE);
     EndDrawing();
 
-    if (IsKeyPressed(KEY_R)) {
-      char *data = LoadFileText(file_path);
-      if (data) {
-        penUpdate(data, strlen(data));
-        UnloadFileText(data);
-      }
+    if ((watching && watchChanged(&watch)) || IsKeyPressed(KEY_R)) {
+      update(file_path);
     }
   }
+
+#ifdef __linux__
+  if (watching) {
+    close(watch.fd);
+  }
+#endif
+
+  UnloadRenderTexture(target);
   CloseWindow();
 }
@@ -3,82 +3,718 @@
 #define ELANG_IMPLEMENTATION
 #include "elang.h"
 
+#ifndef __wasm32__
+#include <stdlib.h>
+#include <time.h>
+#endif
+
 // Math
 #define PI 3.14159265
-#define EPS 1e-6
 
 float remf(float x, float y) {
   return x - (int)(x / y) * y;
 }
 
-float absf(float x) {
-  if (x < 0) {
-    return -x;
+// Reduces x by the nearest multiple of pi/2, split in three so the reduction is
+// exact for the angles the canvas uses, then evaluates the minimax polynomials
+// from Cephes on [-pi/4, pi/4]
+void mathSinCos(float x, float *sine, float *cosine) {
+  float k = x * 0.636619772f;
+  int q = k < 0 ? k - 0.5f : k + 0.5f;
+  float r = x - q * 1.5703125f - q * 4.837512969970703125e-4f - q * 7.54978995489188216e-8f;
+  float z = r * r;
+
+  float s = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * r + r;
+  float c = (2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f;
+  c = c * z * z - 0.5f * z + 1;
+
+  switch (q & 3) {
+  case 0:
+    *sine = s;
+    *cosine = c;
+    break;
+
+  case 1:
+    *sine = c;
+    *cosine = -s;
+    break;
+
+  case 2:
+    *sine = -s;
+    *cosine = -c;
+    break;
+
+  case 3:
+    *sine = -c;
+    *cosine = s;
+    break;
   }
-  return x;
 }
 
-float sinf(float x) {
-  float s = x;
-  float t = x;
-  for (int i = 1; absf(t / s) > EPS; i++) {
-    t *= -x * x / ((2 * i + 1) * 2 * i);
-    s += t;
+// Memory
+#ifdef __wasm32__
+#define PAGE_SIZE 65536
+
+// The wasm build has no libc, so memory is taken from the end of linear memory
+// and never returned
+void *memoryAlloc(void *context, int size) {
+  int start = __builtin_wasm_memory_grow(0, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+  if (start < 0) {
+    return 0;
   }
-  return s;
+  return (void *)((unsigned long)start * PAGE_SIZE);
 }
 
-float cosf(float x) {
-  float s = 1;
-  float t = 1;
-  for (int i = 1; absf(t / s) > EPS; i++) {
-    t *= -x * x / ((2 * i - 1) * 2 * i);
-    s += t;
-  }
-  return s;
+ElangAllocator memoryAllocator = {.alloc = memoryAlloc};
+#else
+void *memoryAlloc(void *context, int size) {
+  return malloc(size);
+}
+
+void memoryFree(void *context, void *data) {
+  free(data);
+}
+
+ElangAllocator memoryAllocator = {.alloc = memoryAlloc, .free = memoryFree};
+#endif
+
+// Clock
+#define PEN_TIME_LIMIT 5000
+
+#ifdef __wasm32__
+// Milliseconds, from the page
+double platformNow(void);
+
+double clockNow(void *context) {
+  return platformNow();
+}
+#else
+double clockNow(void *context) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
+#endif
 
 // Canvas
-#define CANVAS_CAP 1024
+// Points are kept in a list of chunks, so they never move once recorded. The
+// chunks are reused by the next run and only freed with the pen. A chunk just
+// fits in a wasm page.
+//
+// Every chunk, and every block of CANVAS_BLOCK points in it, keeps the bounds of
+// its segments, so drawing can skip the parts of the canvas off screen.
+#define CANVAS_CHUNK 7040
+#define CANVAS_BLOCK 64
+#define CANVAS_LIMIT (64 << 20)
+
+typedef struct {
+  float x1;
+  float y1;
+  float x2;
+  float y2;
+} Bounds;
+
+typedef struct CanvasChunk CanvasChunk;
+
+struct CanvasChunk {
+  CanvasChunk *next;
+  int count;
+  Bounds bounds;
+  Bounds blocks[CANVAS_CHUNK / CANVAS_BLOCK];
+  float xs[CANVAS_CHUNK];
+  float ys[CANVAS_CHUNK];
+  unsigned char starts[CANVAS_CHUNK]; // Whether the point starts a new stroke
+};
+
+typedef struct {
+  CanvasChunk *head;
+  CanvasChunk *tail;
+  int count;
+  int chunks;
+  int limit;
+  int full; // A point did not fit, which fails the run
+
+  PenSink sink;
+  void *context;
+
+  float x;
+  float y;
+  int up;
+  int lifted; // The next line starts a new stroke
+  float angle;
+  float sin;
+  float cos;
+  int generation;
+} Canvas;
+
+// Points are handed to the platform in strips of at most STRIP_CAP
+#define STRIP_CAP 1024
+
+// Points are kept within SCREEN_LIMIT pixels of the center, zooming in has no
+// limit and a visible block can hold points far off screen
+#define SCREEN_LIMIT (1 << 20)
+
+// Segments drawn by the last render, kept in a direct mapped table
+#define SEGMENTS_CAP 16384
+
+typedef struct {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+  int serial;
+} Segment;
+
+struct Pen {
+  Canvas canvas;
+  ElangVM *vm;
+  float strip[STRIP_CAP * 2];
+  int stripCount;
+
+  int simplify;
+  Segment *segments;
+  int serial;
+  int segmentsIn;
+  int segmentsOut;
+
+  // The canvas point at the center of the screen and the pixels per unit
+  float viewX;
+  float viewY;
+  float scale;
+
+  int centerX;
+  int centerY;
+  int lastX;
+  int lastY;
+
+  // The hash of the script the canvas holds, and of the one compiled last
+  unsigned long long replay;
+  unsigned long long replayNext;
+  int replayValid;
+  int replayHits;
+  int replayMisses;
+};
+
+void boundsAdd(Bounds *bounds, float x, float y) {
+  bounds->x1 = x < bounds->x1 ? x : bounds->x1;
+  bounds->y1 = y < bounds->y1 ? y : bounds->y1;
+  bounds->x2 = x > bounds->x2 ? x : bounds->x2;
+  bounds->y2 = y > bounds->y2 ? y : bounds->y2;
+}
+
+int boundsOverlap(Bounds *a, Bounds *b) {
+  return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+Canvas *canvasOf(ElangVM *vm) {
+  return &((Pen *)elangVMUser(vm))->canvas;
+}
+
+// Hands the strokes of the last chunk to the sink and keeps the last point, so
+// the next chunk continues from it
+void canvasFlush(Canvas *canvas) {
+  CanvasChunk *chunk = canvas->tail;
+  if (!canvas->sink || !chunk || chunk->count < 2) {
+    return;
+  }
+
+  int start = 0;
+  for (int i = 1; i <= chunk->count; i++) {
+    if (i == chunk->count || chunk->starts[i]) {
+      if (i - start > 1) {
+        canvas->sink(canvas->context, &chunk->xs[start], &chunk->ys[start], i - start);
+      }
+      start = i;
+    }
+  }
+
+  chunk->xs[0] = chunk->xs[chunk->count - 1];
+  chunk->ys[0] = chunk->ys[chunk->count - 1];
+  chunk->starts[0] = 1;
+  chunk->bounds = (Bounds){chunk->xs[0], chunk->ys[0], chunk->xs[0], chunk->ys[0]};
+  chunk->blocks[0] = chunk->bounds;
+  canvas->count -= chunk->count - 1;
+  chunk->count = 1;
+}
+
+int canvasPush(Canvas *canvas, float x, float y, int start) {
+  CanvasChunk *chunk = canvas->tail;
+  if (chunk && chunk->count == CANVAS_CHUNK && canvas->sink) {
+    canvasFlush(canvas);
+  } else if (!chunk || chunk->count == CANVAS_CHUNK) {
+    CanvasChunk *next = chunk ? chunk->next : canvas->head;
+    if (!next) {
+      if (canvas->chunks && (canvas->chunks + 1) * (long)sizeof(CanvasChunk) > canvas->limit) {
+        LOG_ERROR(STR("Canvas limit exceeded"));
+        return 0;
+      }
 
-int canvasCount;
-float canvasXs[CANVAS_CAP];
-float canvasYs[CANVAS_CAP];
-float canvasAngle;
+      next = memoryAlloc(0, sizeof(CanvasChunk));
+      if (!next) {
+        LOG_ERROR(STR("Out of memory"));
+        return 0;
+      }
+
+      next->next = 0;
+      if (chunk) {
+        chunk->next = next;
+      } else {
+        canvas->head = next;
+      }
+      canvas->chunks++;
+    }
+
+    next->count = 0;
+    chunk = canvas->tail = next;
+  }
+
+  // A block also covers the segment leading into it, which starts at the
+  // position before the point
+  int i = chunk->count;
+  Bounds *block = &chunk->blocks[i / CANVAS_BLOCK];
+  if (i % CANVAS_BLOCK == 0) {
+    float px = start ? x : canvas->x;
+    float py = start ? y : canvas->y;
+    *block = (Bounds){px, py, px, py};
+    if (i == 0) {
+      chunk->bounds = *block;
+    } else {
+      boundsAdd(&chunk->bounds, px, py);
+    }
+  }
+  boundsAdd(block, x, y);
+  boundsAdd(&chunk->bounds, x, y);
+
+  chunk->xs[i] = x;
+  chunk->ys[i] = y;
+  chunk->starts[i] = start;
+  chunk->count++;
+  canvas->count++;
+  return 1;
+}
+
+// Moves to (x, y), drawing a line unless the pen is up. A line that does not
+// fit fails the run.
+void canvasLine(ElangVM *vm, Canvas *canvas, float x, float y) {
+  if (!canvas->up && !canvas->full) {
+    if ((canvas->lifted && !canvasPush(canvas, canvas->x, canvas->y, 1)) ||
+        !canvasPush(canvas, x, y, 0)) {
+      canvas->full = 1;
+      elangVMFail(vm);
+    }
+    canvas->lifted = 0;
+  }
+
+  canvas->x = x;
+  canvas->y = y;
+}
+
+float canvasMove(ElangVM *vm, float *arg) {
+  Canvas *canvas = canvasOf(vm);
+  canvasLine(vm, canvas, canvas->x + *arg * canvas->cos, canvas->y + *arg * canvas->sin);
+  return 0;
+}
+
+float canvasGoto(ElangVM *vm, float *args) {
+  canvasLine(vm, canvasOf(vm), args[0], args[1]);
+  return 0;
+}
+
+float canvasPenUp(ElangVM *vm, float *args) {
+  Canvas *canvas = canvasOf(vm);
+  canvas->up = 1;
+  canvas->lifted = 1;
+  return 0;
+}
+
+float canvasPenDown(ElangVM *vm, float *args) {
+  canvasOf(vm)->up = 0;
+  return 0;
+}
+
+void canvasReset(Canvas *canvas) {
+  canvas->tail = 0;
+  canvas->count = 0;
+  canvas->full = 0;
+  canvas->x = 0;
+  canvas->y = 0;
+  canvas->up = 0;
+  canvas->lifted = 1;
+  canvas->angle = 0;
+  canvas->sin = 0;
+  canvas->cos = 1;
+  canvas->generation++;
+}
+
+void canvasFree(Canvas *canvas) {
+  while (canvas->head) {
+    CanvasChunk *next = canvas->head->next;
+    memoryAllocator.free(0, canvas->head);
+    canvas->head = next;
+  }
+}
+
+float canvasRotate(ElangVM *vm, float *arg) {
+  Canvas *canvas = canvasOf(vm);
+  canvas->angle = remf(canvas->angle - *arg * PI / 180, PI * 2);
+  mathSinCos(canvas->angle, &canvas->sin, &canvas->cos);
+  return 0;
+}
+
+// Simplify
+void stripEnd(Pen *pen) {
+  if (pen->stripCount > 1) {
+    platformDrawLines(pen->strip, pen->stripCount);
+    pen->segmentsOut += pen->stripCount - 1;
+  }
+  pen->stripCount = 0;
+}
+
+void stripPush(Pen *pen, int x, int y) {
+  float *strip = pen->strip;
+  int count = pen->stripCount;
+
+  // A point continuing the last segment in the same direction replaces its end
+  if (pen->simplify && count >= 2) {
+    double ax = strip[count * 2 - 2] - strip[count * 2 - 4];
+    double ay = strip[count * 2 - 1] - strip[count * 2 - 3];
+    double bx = x - strip[count * 2 - 2];
+    double by = y - strip[count * 2 - 1];
+    if (ax * by == ay * bx && ax * bx + ay * by > 0) {
+      strip[count * 2 - 2] = x;
+      strip[count * 2 - 1] = y;
+      return;
+    }
+  }
+
+  strip[count * 2] = x;
+  strip[count * 2 + 1] = y;
+  count++;
+
+  // Every strip of a stroke starts where the one before ended
+  if (count == STRIP_CAP) {
+    platformDrawLines(strip, count);
+    pen->segmentsOut += count - 1;
+    strip[0] = strip[count * 2 - 2];
+    strip[1] = strip[count * 2 - 1];
+    count = 1;
+  }
+  pen->stripCount = count;
+}
+
+// Returns whether the segment was drawn before in this render. A segment evicted
+// by another one with the same hash is drawn again, which only costs time.
+int segmentSeen(Pen *pen, int x1, int y1, int x2, int y2) {
+  if (x1 > x2 || (x1 == x2 && y1 > y2)) {
+    int x = x1;
+    int y = y1;
+    x1 = x2;
+    y1 = y2;
+    x2 = x;
+    y2 = y;
+  }
 
-float canvasMove(float *arg) {
-  if (canvasCount < CANVAS_CAP) {
-    canvasXs[canvasCount] = canvasXs[canvasCount - 1] + *arg * cosf(canvasAngle);
-    canvasYs[canvasCount] = canvasYs[canvasCount - 1] + *arg * sinf(canvasAngle);
-    canvasCount++;
+  unsigned int hash = (unsigned int)x1 * 73856093u ^ (unsigned int)y1 * 19349663u ^
+                      (unsigned int)x2 * 83492791u ^ (unsigned int)y2 * 2654435761u;
+  Segment *segment = &pen->segments[(hash ^ hash >> 15) & (SEGMENTS_CAP - 1)];
+  if (segment->serial == pen->serial && segment->x1 == x1 && segment->y1 == y1 &&
+      segment->x2 == x2 && segment->y2 == y2) {
+    return 1;
   }
+
+  *segment = (Segment){x1, y1, x2, y2, pen->serial};
   return 0;
 }
 
-float canvasRotate(float *arg) {
-  canvasAngle = remf(canvasAngle - *arg * PI / 180, PI * 2);
+// Pen
+Pen penMain;
+
+int penBind(Pen *pen) {
+  pen->canvas.limit = CANVAS_LIMIT;
+  canvasReset(&pen->canvas);
+  return elangVMRegisterNative(pen->vm, "move", 1, canvasMove) &&
+         elangVMRegisterNative(pen->vm, "rotate", 1, canvasRotate) &&
+         elangVMRegisterNative(pen->vm, "goto", 2, canvasGoto) &&
+         elangVMRegisterNative(pen->vm, "penup", 0, canvasPenUp) &&
+         elangVMRegisterNative(pen->vm, "pendown", 0, canvasPenDown);
+}
+
+void penDestroy(Pen *pen) {
+  if (pen->vm) {
+    elangVMDestroy(pen->vm);
+  }
+
+  if (memoryAllocator.free) {
+    canvasFree(&pen->canvas);
+    memoryAllocator.free(0, pen->segments);
+    memoryAllocator.free(0, pen);
+  }
+}
+
+Pen *penCreate(void) {
+  Pen *pen = memoryAlloc(0, sizeof(Pen));
+  if (!pen) {
+    return 0;
+  }
+
+  *pen = (Pen){.scale = 1};
+  pen->vm = elangVMCreate(memoryAllocator, pen);
+  if (!pen->vm || !penBind(pen)) {
+    penDestroy(pen);
+    return 0;
+  }
+  return pen;
+}
+
+int penCompile(Pen *pen, char *data, int size) {
+  pen->replayValid = 0;
+  pen->replayNext = elangVMHash(pen->vm, data, size);
+  if (elangIsBytecode(data, size)) {
+    return elangVMLoadBytecode(pen->vm, data, size);
+  }
+  return elangVMCompile(pen->vm, data, size);
+}
+
+int penRun(Pen *pen) {
+  canvasReset(&pen->canvas);
+  int ok = elangVMRun(pen->vm);
+  canvasFlush(&pen->canvas);
+
+  pen->replay = pen->replayNext;
+  pen->replayValid = ok;
+  return ok;
+}
+
+int penReplay(Pen *pen, char *data, int size) {
+  if (pen->replayValid && pen->replay == elangVMHash(pen->vm, data, size)) {
+    pen->replayHits++;
+    return 1;
+  }
+
+  pen->replayMisses++;
   return 0;
 }
 
+void penReplayStats(Pen *pen, int *hits, int *misses) {
+  *hits = pen->replayHits;
+  *misses = pen->replayMisses;
+}
+
+void penSetCanvasLimit(Pen *pen, int bytes) {
+  pen->canvas.limit = bytes;
+  pen->replayValid = 0;
+}
+
+void penSetBudget(Pen *pen, long long fuel, int milliseconds) {
+  elangVMSetFuel(pen->vm, fuel);
+  elangVMSetTimeLimit(pen->vm, milliseconds, clockNow, 0);
+}
+
+void penStream(Pen *pen, PenSink sink, void *context) {
+  pen->canvas.sink = sink;
+  pen->canvas.context = context;
+  pen->replayValid = 0;
+}
+
+int penSetSimplify(Pen *pen, int enabled) {
+  if (enabled && !pen->segments) {
+    pen->segments = memoryAlloc(0, SEGMENTS_CAP * sizeof(Segment));
+    if (!pen->segments) {
+      return 0;
+    }
+
+    for (int i = 0; i < SEGMENTS_CAP; i++) {
+      pen->segments[i].serial = 0;
+    }
+  }
+
+  pen->simplify = enabled;
+  return 1;
+}
+
+void penSetView(Pen *pen, float x, float y, float scale) {
+  pen->viewX = x;
+  pen->viewY = y;
+  pen->scale = scale;
+}
+
+int screenOffset(float offset) {
+  if (offset >= -SCREEN_LIMIT && offset <= SCREEN_LIMIT) {
+    return offset;
+  }
+  return offset > 0 ? SCREEN_LIMIT : -SCREEN_LIMIT;
+}
+
+void penDrawPoint(Pen *pen, float px, float py, int start) {
+  int x = pen->centerX + screenOffset((px - pen->viewX) * pen->scale);
+  int y = pen->centerY + screenOffset((py - pen->viewY) * pen->scale);
+  if (start) {
+    stripEnd(pen);
+  } else {
+    pen->segmentsIn++;
+
+    // Segments within a pixel are dropped when simplifying or zoomed out, and
+    // segments drawn before when simplifying
+    if ((pen->simplify || pen->scale < 1) && x == pen->lastX && y == pen->lastY) {
+      return;
+    }
+
+    if (pen->simplify && segmentSeen(pen, pen->lastX, pen->lastY, x, y)) {
+      stripEnd(pen);
+    }
+  }
+
+  stripPush(pen, x, y);
+  pen->lastX = x;
+  pen->lastY = y;
+}
+
+// Whether zooming out shrank the bounds to less than a pixel
+int penTiny(Pen *pen, Bounds *bounds) {
+  return pen->scale < 1 && (bounds->x2 - bounds->x1) * pen->scale < 1 &&
+         (bounds->y2 - bounds->y1) * pen->scale < 1;
+}
+
+// Draws the points first to last of a chunk, where the point before first is
+// (x, y). A stroke cut by a part which was skipped resumes from there, and a
+// tiny range is drawn as a single segment.
+void penDrawRange(Pen *pen, CanvasChunk *chunk, int first, int last, float x, float y, int tiny) {
+  if (!pen->stripCount && !chunk->starts[first]) {
+    penDrawPoint(pen, x, y, 1);
+  }
+
+  if (tiny) {
+    penDrawPoint(pen, chunk->xs[first], chunk->ys[first], chunk->starts[first]);
+    if (last - first > 1) {
+      penDrawPoint(pen, chunk->xs[last - 1], chunk->ys[last - 1], 0);
+    }
+    return;
+  }
+
+  for (int i = first; i < last; i++) {
+    penDrawPoint(pen, chunk->xs[i], chunk->ys[i], chunk->starts[i]);
+  }
+}
+
+void penDraw(Pen *pen, int w, int h) {
+  Canvas *canvas = &pen->canvas;
+  float scale = pen->scale;
+  pen->centerX = w / 2;
+  pen->centerY = h / 2;
+
+  // The canvas on screen, with two pixels to spare for the width of the lines
+  Bounds view = {
+      pen->viewX - (pen->centerX + 2) / scale,
+      pen->viewY - (pen->centerY + 2) / scale,
+      pen->viewX + (w - pen->centerX + 2) / scale,
+      pen->viewY + (h - pen->centerY + 2) / scale,
+  };
+
+  platformClear();
+  pen->stripCount = 0;
+  pen->segmentsIn = 0;
+  pen->segmentsOut = 0;
+  pen->serial++;
+
+  float x = 0;
+  float y = 0;
+  for (CanvasChunk *chunk = canvas->tail ? canvas->head : 0; chunk; chunk = chunk->next) {
+    if (!boundsOverlap(&chunk->bounds, &view)) {
+      stripEnd(pen);
+    } else if (penTiny(pen, &chunk->bounds)) {
+      penDrawRange(pen, chunk, 0, chunk->count, x, y, 1);
+    } else {
+      for (int first = 0; first < chunk->count; first += CANVAS_BLOCK) {
+        int last = first + CANVAS_BLOCK < chunk->count ? first + CANVAS_BLOCK : chunk->count;
+        Bounds *block = &chunk->blocks[first / CANVAS_BLOCK];
+        if (boundsOverlap(block, &view)) {
+          penDrawRange(pen, chunk, first, last, first ? chunk->xs[first - 1] : x,
+                       first ? chunk->ys[first - 1] : y, penTiny(pen, block));
+        } else {
+          stripEnd(pen);
+        }
+      }
+    }
+
+    x = chunk->xs[chunk->count - 1];
+    y = chunk->ys[chunk->count - 1];
+    if (chunk == canvas->tail) {
+      break;
+    }
+  }
+
+  stripEnd(pen);
+}
+
+void penDrawStats(Pen *pen, int *in, int *out) {
+  *in = pen->segmentsIn;
+  *out = pen->segmentsOut;
+}
+
 // Exports
 void penInit(void) {
-  elangRegisterNative("move", 1, canvasMove);
-  elangRegisterNative("rotate", 1, canvasRotate);
+  elangSetAllocator(memoryAllocator);
+  penMain.vm = elangDefault();
+  penMain.scale = 1;
+  elangVMSetUser(penMain.vm, &penMain);
+  penSetBudget(&penMain, 0, PEN_TIME_LIMIT);
+  penBind(&penMain);
 }
 
 void penRender(int w, int h) {
-  w /= 2;
-  h /= 2;
+  penDraw(&penMain, w, h);
+}
 
-  platformClear();
-  for (int i = 1; i < canvasCount; i++) {
-    platformDrawLine(w + (int)canvasXs[i - 1], h + (int)canvasYs[i - 1], w + (int)canvasXs[i],
-                     h + (int)canvasYs[i]);
-  }
+void penView(float x, float y, float scale) {
+  penSetView(&penMain, x, y, scale);
+}
+
+int penSimplify(int enabled) {
+  return penSetSimplify(&penMain, enabled);
+}
+
+void penRenderStats(int *in, int *out) {
+  penDrawStats(&penMain, in, out);
 }
 
 void penUpdate(char *data, int size) {
-  canvasAngle = 0;
-  canvasCount = 1;
-  elangCompile(data, size) && elangRun();
+  if (penReplay(&penMain, data, size)) {
+    return;
+  }
+
+  canvasReset(&penMain.canvas);
+  penCompile(&penMain, data, size) && penRun(&penMain);
+}
+
+void penUpdateProgram(int (*program)(ElangVM *vm)) {
+  canvasReset(&penMain.canvas);
+  program(penMain.vm);
+  canvasFlush(&penMain.canvas);
+  penMain.replayValid = 0;
+}
+
+void penUpdateStats(int *hits, int *misses) {
+  penReplayStats(&penMain, hits, misses);
+}
+
+int penGeneration(void) {
+  return penMain.canvas.generation;
+}
+
+int penPoint(int index, float *x, float *y, int *start) {
+  Canvas *canvas = &penMain.canvas;
+  if (index < 0 || index >= canvas->count) {
+    return 0;
+  }
+
+  CanvasChunk *chunk = canvas->head;
+  while (index >= chunk->count) {
+    index -= chunk->count;
+    chunk = chunk->next;
+  }
+
+  *x = chunk->xs[index];
+  *y = chunk->ys[index];
+  *start = chunk->starts[index];
+  return 1;
 }
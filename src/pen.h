@@ -1,14 +1,77 @@
 #ifndef PEN_H
 #define PEN_H
 
+struct ElangVM;
+
+typedef struct Pen Pen;
+
+// Receives count connected points of a stroke, a stroke spanning several calls
+// starts every call where the one before ended
+typedef void (*PenSink)(void *context, float *xs, float *ys, int count);
+
 void platformClear(void);
 void platformErrorStart(void);
 void platformErrorPush(char *data, int count);
 void platformErrorEnd(void);
-void platformDrawLine(int x1, int y1, int x2, int y2);
+
+// Draws connected lines through count points, stored as x, y pairs. Every
+// stroke of the canvas takes at least one call.
+void platformDrawLines(float *points, int count);
 
 void penInit(void);
 void penRender(int w, int h);
+void penView(float x, float y, float scale);
+int penSimplify(int enabled);
+void penRenderStats(int *in, int *out);
+// Runs the script on the main pen, unless the main pen already holds it
 void penUpdate(char *data, int size);
+void penUpdateProgram(int (*program)(struct ElangVM *vm));
+void penUpdateStats(int *hits, int *misses);
+int penPoint(int index, float *x, float *y, int *start);
+
+// Changes every time the main pen is run, until then the last render can be
+// reused
+int penGeneration(void);
+
+// Every pen has its own canvas and VM, separate pens can be used from separate
+// threads. The functions above work on the main pen. penCompile() also takes
+// bytecode saved by elangSaveBytecode(), which is run in place and has to stay
+// until the next penCompile().
+Pen *penCreate(void);
+void penDestroy(Pen *pen);
+int penCompile(Pen *pen, char *data, int size);
+int penRun(Pen *pen);
+void penDraw(Pen *pen, int w, int h);
+
+// Centers the canvas point (x, y) on the screen, zoomed in scale times. Only
+// the parts of the canvas on screen are drawn, and parts smaller than a pixel
+// are drawn as a single line when zoomed out.
+void penSetView(Pen *pen, float x, float y, float scale);
+
+// Drawing merges collinear points and drops segments within a pixel and
+// segments drawn before. Stats report the segments of the last draw, before and
+// after simplifying.
+int penSetSimplify(Pen *pen, int enabled);
+void penDrawStats(Pen *pen, int *in, int *out);
+
+// Whether the canvas holds what the script draws, because it is the script the
+// pen ran last with the same natives and limits. A pen that streams relies on
+// its sink to still hold what it was given. Stats count the scripts replayed
+// and those which had to be run.
+int penReplay(Pen *pen, char *data, int size);
+void penReplayStats(Pen *pen, int *hits, int *misses);
+
+// The canvas grows until its points take more than bytes, 64 MiB by default,
+// and a run that draws past that fails with an error
+void penSetCanvasLimit(Pen *pen, int bytes);
+
+// Stops a run after fuel calls and loop iterations, or after milliseconds, with
+// an error. Zero means no limit, the default, but the pen of the exports stops
+// after 5 seconds so a script that never ends cannot hang the editor.
+void penSetBudget(Pen *pen, long long fuel, int milliseconds);
+
+// Hands the points to sink while the script runs, a chunk at a time, instead
+// of keeping them for penDraw(). The pen then only holds the last chunk.
+void penStream(Pen *pen, PenSink sink, void *context);
 
 #endif
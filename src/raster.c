@@ -0,0 +1,506 @@
+#include "raster.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86
+#include <immintrin.h>
+#endif
+
+// The kernels only agree to the bit when a * x + k is not fused, build with
+// -ffp-contract=off on GCC
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#define RASTER_TILE 64
+#define RASTER_THREADS_CAP 64
+
+// Span
+// Darkens row[xa..xb] by the coverage of a line, 1 - |e| where e = a * x + k is
+// the offset of the pixel from the line along its minor axis. The SIMD kernels
+// do the same float operations in the same order, so all of them agree to the
+// bit.
+void rasterSpanScalar(unsigned char *row, int xa, int xb, float a, float k) {
+  for (int x = xa; x <= xb; x++) {
+    float cover = 1 - fabsf(a * x + k);
+    cover = cover > 0 ? cover : 0;
+    int value = 255 - cover * 255 + 0.5f;
+    row[x] = row[x] < value ? row[x] : value;
+  }
+}
+
+#ifdef RASTER_X86
+__attribute__((target("sse2"))) void rasterSpanSse2(unsigned char *row, int xa, int xb, float a,
+                                                    float k) {
+  __m128 one = _mm_set1_ps(1);
+  __m128 full = _mm_set1_ps(255);
+  __m128 half = _mm_set1_ps(0.5f);
+  __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 va = _mm_set1_ps(a);
+  __m128 vk = _mm_set1_ps(k);
+  __m128i step = _mm_setr_epi32(0, 1, 2, 3);
+
+  int x = xa;
+  for (; x + 15 <= xb; x += 16) {
+    __m128i values[4];
+    for (int j = 0; j < 4; j++) {
+      __m128 xs = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x + j * 4), step));
+      __m128 e = _mm_andnot_ps(sign, _mm_add_ps(_mm_mul_ps(va, xs), vk));
+      __m128 cover = _mm_max_ps(_mm_sub_ps(one, e), _mm_setzero_ps());
+      values[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(full, _mm_mul_ps(cover, full)), half));
+    }
+
+    __m128i lo = _mm_packs_epi32(values[0], values[1]);
+    __m128i hi = _mm_packs_epi32(values[2], values[3]);
+    __m128i *pixels = (__m128i *)(row + x);
+    _mm_storeu_si128(pixels, _mm_min_epu8(_mm_loadu_si128(pixels), _mm_packus_epi16(lo, hi)));
+  }
+
+  rasterSpanScalar(row, x, xb, a, k);
+}
+
+__attribute__((target("avx2"))) void rasterSpanAvx2(unsigned char *row, int xa, int xb, float a,
+                                                    float k) {
+  __m256 one = _mm256_set1_ps(1);
+  __m256 full = _mm256_set1_ps(255);
+  __m256 half = _mm256_set1_ps(0.5f);
+  __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 va = _mm256_set1_ps(a);
+  __m256 vk = _mm256_set1_ps(k);
+  __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  // The packs work within 128-bit lanes, this puts the dwords back in order
+  __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+  int x = xa;
+  for (; x + 31 <= xb; x += 32) {
+    __m256i values[4];
+    for (int j = 0; j < 4; j++) {
+      __m256 xs = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x + j * 8), step));
+      __m256 e = _mm256_andnot_ps(sign, _mm256_add_ps(_mm256_mul_ps(va, xs), vk));
+      __m256 cover = _mm256_max_ps(_mm256_sub_ps(one, e), _mm256_setzero_ps());
+      values[j] =
+          _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sub_ps(full, _mm256_mul_ps(cover, full)), half));
+    }
+
+    __m256i lo = _mm256_packs_epi32(values[0], values[1]);
+    __m256i hi = _mm256_packs_epi32(values[2], values[3]);
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order);
+    __m256i *pixels = (__m256i *)(row + x);
+    _mm256_storeu_si256(pixels, _mm256_min_epu8(_mm256_loadu_si256(pixels), packed));
+  }
+
+  // The rest runs SSE code, which stalls while the upper halves are dirty
+  _mm256_zeroupper();
+  rasterSpanSse2(row, x, xb, a, k);
+}
+#endif
+
+int rasterSupports(RasterKernel kernel) {
+  switch (kernel) {
+  case RASTER_SCALAR:
+    return 1;
+
+#ifdef RASTER_X86
+  case RASTER_SSE2:
+    return __builtin_cpu_supports("sse2");
+
+  case RASTER_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+
+  default:
+    return 0;
+  }
+}
+
+void rasterSpan(Raster *raster, unsigned char *row, int xa, int xb, float a, float k) {
+  switch (raster->kernel) {
+#ifdef RASTER_X86
+  case RASTER_SSE2:
+    rasterSpanSse2(row, xa, xb, a, k);
+    break;
+
+  case RASTER_AVX2:
+    rasterSpanAvx2(row, xa, xb, a, k);
+    break;
+#endif
+
+  default:
+    rasterSpanScalar(row, xa, xb, a, k);
+    break;
+  }
+}
+
+// Line
+typedef struct {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+} RasterClip;
+
+int rasterFinite(float *line) {
+  return isfinite(line[0] + line[1] + line[2] + line[3]) && isfinite(line[2] - line[0]) &&
+         isfinite(line[3] - line[1]);
+}
+
+// floorf(), ceilf() and friends are library calls without SSE4.1 or fast math,
+// these only work on values already clamped to the clip
+int rasterFloor(float x) {
+  int i = x;
+  return i - (x < i);
+}
+
+int rasterCeil(float x) {
+  int i = x;
+  return i + (x > i);
+}
+
+float rasterClamp(float x, float lo, float hi) {
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+void rasterLine(Raster *raster, float *line, RasterClip clip) {
+  float x1 = line[0];
+  float y1 = line[1];
+  float x2 = line[2];
+  float y2 = line[3];
+  if (!rasterFinite(line)) {
+    return;
+  }
+
+  float dx = x2 - x1;
+  float dy = y2 - y1;
+  float ax = dx < 0 ? -dx : dx;
+  float ay = dy < 0 ? -dy : dy;
+  if (ax == 0 && ay == 0) {
+    float x = x1 + 0.5f;
+    float y = y1 + 0.5f;
+    if (x >= clip.x0 && x < clip.x1 + 1 && y >= clip.y0 && y < clip.y1 + 1) {
+      raster->pixels[rasterFloor(y) * raster->width + rasterFloor(x)] = 0;
+    }
+    return;
+  }
+
+  // Scaled by the major axis, so every column of a mostly horizontal line (or
+  // every row of a mostly vertical one) has a total coverage of one
+  float m = ax > ay ? ax : ay;
+  float a = -dy / m;
+  float b = dx / m;
+  float c = -(a * x1 + b * y1);
+  float w = raster->smooth ? 1 : 0.5f;
+
+  float top = y1 < y2 ? y1 : y2;
+  float bottom = y1 < y2 ? y2 : y1;
+  int left = clip.x0;
+  int right = clip.x1;
+  if (ax >= ay) {
+    left = rasterCeil(rasterClamp(x1 < x2 ? x1 : x2, clip.x0, clip.x1 + 1));
+    right = rasterFloor(rasterClamp(x1 < x2 ? x2 : x1, clip.x0 - 1, clip.x1));
+
+    // Only the rows the line crosses within the columns of the clip, with a
+    // pixel to spare so rounding never loses one
+    float enter = -(a * left + c) / b;
+    float leave = -(a * right + c) / b;
+    top = (enter < leave ? enter : leave) - w - 1;
+    bottom = (enter < leave ? leave : enter) + w + 1;
+  }
+
+  int ya = rasterCeil(rasterClamp(top, clip.y0, clip.y1 + 1));
+  int yb = rasterFloor(rasterClamp(bottom, clip.y0 - 1, clip.y1));
+  if (left > right) {
+    return;
+  }
+
+  // The pixels of a row where -w <= e < w lie between p and q. Everything here
+  // only depends on the row, so tiles sharing a line agree on its pixels.
+  float inverse = a != 0 ? 1 / a : 0;
+  for (int y = ya; y <= yb; y++) {
+    float k = b * y + c;
+    int xa = left;
+    int xb = right;
+    if (a != 0) {
+      float p = (-w - k) * inverse;
+      float q = (w - k) * inverse;
+      if (a > 0) {
+        xa = rasterCeil(rasterClamp(p, left, right + 1));
+        xb = rasterCeil(rasterClamp(q, left, right + 1)) - 1;
+      } else {
+        xa = rasterFloor(rasterClamp(q, left - 1, right)) + 1;
+        xb = rasterFloor(rasterClamp(p, left - 1, right));
+      }
+    } else if (k < -w || k >= w) {
+      continue;
+    }
+
+    if (xa > xb) {
+      continue;
+    }
+
+    unsigned char *row = raster->pixels + y * raster->width;
+    if (raster->smooth) {
+      rasterSpan(raster, row, xa, xb, a, k);
+    } else if (xa == xb) {
+      row[xa] = 0;
+    } else {
+      memset(row + xa, 0, xb - xa + 1);
+    }
+  }
+}
+
+void rasterDrawLineReference(Raster *raster, int x1, int y1, int x2, int y2) {
+  int dx = abs(x2 - x1);
+  int dy = -abs(y2 - y1);
+  int sx = x1 < x2 ? 1 : -1;
+  int sy = y1 < y2 ? 1 : -1;
+  int error = dx + dy;
+
+  while (1) {
+    if (x1 >= 0 && x1 < raster->width && y1 >= 0 && y1 < raster->height) {
+      raster->pixels[y1 * raster->width + x1] = 0;
+    }
+
+    if (x1 == x2 && y1 == y2) {
+      break;
+    }
+
+    int e2 = 2 * error;
+    if (e2 >= dy) {
+      error += dy;
+      x1 += sx;
+    }
+
+    if (e2 <= dx) {
+      error += dx;
+      y1 += sy;
+    }
+  }
+}
+
+// Tile
+typedef struct {
+  Raster *raster;
+  int columns;
+  int count;
+
+  pthread_mutex_t lock;
+  int next;
+} RasterWork;
+
+RasterClip rasterTile(Raster *raster, int columns, int tile) {
+  RasterClip clip;
+  clip.x0 = tile % columns * RASTER_TILE;
+  clip.y0 = tile / columns * RASTER_TILE;
+  clip.x1 = (clip.x0 + RASTER_TILE < raster->width ? clip.x0 + RASTER_TILE : raster->width) - 1;
+  clip.y1 = (clip.y0 + RASTER_TILE < raster->height ? clip.y0 + RASTER_TILE : raster->height) - 1;
+  return clip;
+}
+
+// Adds a line to every tile it may touch. Counts go to tiles[t + 1] on the
+// first pass, the second pass appends to the bins through tiles[t].
+void rasterBinLine(Raster *raster, int columns, int index, int fill) {
+  float *line = &raster->lines[index * 4];
+  if (!rasterFinite(line)) {
+    return;
+  }
+
+  float w = (raster->smooth ? 1 : 0.5f) + 1;
+  float left = rasterClamp((line[0] < line[2] ? line[0] : line[2]) - w, 0, raster->width);
+  float right = rasterClamp((line[0] < line[2] ? line[2] : line[0]) + w, -1, raster->width - 1);
+  float top = rasterClamp((line[1] < line[3] ? line[1] : line[3]) - w, 0, raster->height);
+  float bottom = rasterClamp((line[1] < line[3] ? line[3] : line[1]) + w, -1, raster->height - 1);
+  if (left > right || top > bottom) {
+    return;
+  }
+
+  float dx = line[2] - line[0];
+  float dy = line[3] - line[1];
+  float ax = dx < 0 ? -dx : dx;
+  float ay = dy < 0 ? -dy : dy;
+  float m = ax > ay ? ax : ay > 1 ? ay : 1;
+  float a = -dy / m;
+  float b = dx / m;
+  float c = -(a * line[0] + b * line[1]);
+
+  for (int ty = (int)top / RASTER_TILE; ty <= (int)bottom / RASTER_TILE; ty++) {
+    for (int tx = (int)left / RASTER_TILE; tx <= (int)right / RASTER_TILE; tx++) {
+      int tile = ty * columns + tx;
+      RasterClip clip = rasterTile(raster, columns, tile);
+
+      // Skip the tiles of the bounding box which are too far from the line
+      float hw = (clip.x1 - clip.x0) * 0.5f;
+      float hh = (clip.y1 - clip.y0) * 0.5f;
+      float e = a * (clip.x0 + hw) + b * (clip.y0 + hh) + c;
+      if (fabsf(e) > fabsf(a) * hw + fabsf(b) * hh + w) {
+        continue;
+      }
+
+      if (fill) {
+        raster->bins[raster->tiles[tile]++] = index;
+      } else {
+        raster->tiles[tile + 1]++;
+      }
+    }
+  }
+}
+
+int rasterBin(Raster *raster, int columns, int count) {
+  int *tiles = realloc(raster->tiles, (count + 1) * sizeof(int));
+  if (!tiles) {
+    return 0;
+  }
+  raster->tiles = tiles;
+
+  memset(tiles, 0, (count + 1) * sizeof(int));
+  for (int i = 0; i < raster->linesCount; i++) {
+    rasterBinLine(raster, columns, i, 0);
+  }
+
+  for (int i = 0; i < count; i++) {
+    tiles[i + 1] += tiles[i];
+  }
+
+  if (raster->binsCap < tiles[count]) {
+    int *bins = realloc(raster->bins, tiles[count] * sizeof(int));
+    if (!bins) {
+      return 0;
+    }
+    raster->bins = bins;
+    raster->binsCap = tiles[count];
+  }
+
+  for (int i = 0; i < raster->linesCount; i++) {
+    rasterBinLine(raster, columns, i, 1);
+  }
+
+  // Every tiles[t] was advanced to the end of its bin, which is where the next
+  // bin starts
+  for (int i = count; i > 0; i--) {
+    tiles[i] = tiles[i - 1];
+  }
+  tiles[0] = 0;
+  return 1;
+}
+
+void *rasterWorker(void *arg) {
+  RasterWork *work = arg;
+  Raster *raster = work->raster;
+
+  while (1) {
+    pthread_mutex_lock(&work->lock);
+    int tile = work->next++;
+    pthread_mutex_unlock(&work->lock);
+
+    if (tile >= work->count) {
+      break;
+    }
+
+    RasterClip clip = rasterTile(raster, work->columns, tile);
+    for (int i = raster->tiles[tile]; i < raster->tiles[tile + 1]; i++) {
+      rasterLine(raster, &raster->lines[raster->bins[i] * 4], clip);
+    }
+  }
+
+  return 0;
+}
+
+// Raster
+int rasterInit(Raster *raster, int width, int height) {
+  *raster = (Raster){.width = width, .height = height, .threads = 1};
+  raster->pixels = malloc((size_t)width * height);
+  if (!raster->pixels) {
+    return 0;
+  }
+
+  if (rasterSupports(RASTER_AVX2)) {
+    raster->kernel = RASTER_AVX2;
+  } else if (rasterSupports(RASTER_SSE2)) {
+    raster->kernel = RASTER_SSE2;
+  }
+
+  rasterClear(raster);
+  return 1;
+}
+
+void rasterFree(Raster *raster) {
+  free(raster->pixels);
+  free(raster->lines);
+  free(raster->tiles);
+  free(raster->bins);
+}
+
+void rasterClear(Raster *raster) {
+  memset(raster->pixels, 0xff, (size_t)raster->width * raster->height);
+  raster->linesCount = 0;
+}
+
+int rasterPushLine(Raster *raster, float x1, float y1, float x2, float y2) {
+  if (raster->linesCount == raster->linesCap) {
+    int cap = raster->linesCap ? raster->linesCap * 2 : 1024;
+    float *lines = realloc(raster->lines, cap * 4 * sizeof(float));
+    if (!lines) {
+      return 0;
+    }
+
+    raster->lines = lines;
+    raster->linesCap = cap;
+  }
+
+  float *line = &raster->lines[raster->linesCount++ * 4];
+  line[0] = x1;
+  line[1] = y1;
+  line[2] = x2;
+  line[3] = y2;
+  return 1;
+}
+
+void rasterFlush(Raster *raster) {
+  int columns = (raster->width + RASTER_TILE - 1) / RASTER_TILE;
+  int count = columns * ((raster->height + RASTER_TILE - 1) / RASTER_TILE);
+
+  if (raster->threads < 2 || !rasterBin(raster, columns, count)) {
+    RasterClip clip = {0, 0, raster->width - 1, raster->height - 1};
+    for (int i = 0; i < raster->linesCount; i++) {
+      rasterLine(raster, &raster->lines[i * 4], clip);
+    }
+
+    raster->linesCount = 0;
+    return;
+  }
+
+  RasterWork work = {.raster = raster, .columns = columns, .count = count};
+  pthread_mutex_init(&work.lock, 0);
+
+  int threads = raster->threads < RASTER_THREADS_CAP ? raster->threads : RASTER_THREADS_CAP;
+  pthread_t ids[RASTER_THREADS_CAP];
+  int started = 0;
+  while (started + 1 < threads && !pthread_create(&ids[started], 0, rasterWorker, &work)) {
+    started++;
+  }
+
+  // The calling thread takes tiles as well
+  rasterWorker(&work);
+  for (int i = 0; i < started; i++) {
+    pthread_join(ids[i], 0);
+  }
+
+  pthread_mutex_destroy(&work.lock);
+  raster->linesCount = 0;
+}
+
+int rasterWrite(Raster *raster, char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return 0;
+  }
+
+  fprintf(file, "P5\n%d %d\n255\n", raster->width, raster->height);
+  size_t size = (size_t)raster->width * raster->height;
+  int ok = fwrite(raster->pixels, 1, size, file) == size;
+  return fclose(file) == 0 && ok;
+}
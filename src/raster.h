@@ -0,0 +1,48 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+// Software line rasterizer for rendering without a window. Lines are queued
+// with rasterPushLine() and drawn by rasterFlush(), which bins them into tiles
+// and rasterizes the tiles on several threads when raster->threads > 1.
+//
+// Every line is drawn one span per row. Ink is combined with min(), so the
+// image does not depend on the order of the lines or on the number of threads.
+
+typedef enum {
+  RASTER_SCALAR,
+  RASTER_SSE2,
+  RASTER_AVX2
+} RasterKernel;
+
+typedef struct {
+  int width;
+  int height;
+  unsigned char *pixels; // Grayscale, 0 is ink and 255 is paper
+
+  int smooth;
+  int threads;
+  RasterKernel kernel;
+
+  float *lines;
+  int linesCount;
+  int linesCap;
+
+  int *tiles;
+  int *bins;
+  int binsCap;
+} Raster;
+
+int rasterInit(Raster *raster, int width, int height);
+void rasterFree(Raster *raster);
+void rasterClear(Raster *raster);
+int rasterPushLine(Raster *raster, float x1, float y1, float x2, float y2);
+void rasterFlush(Raster *raster);
+int rasterWrite(Raster *raster, char *path);
+
+// The best kernel supported by the CPU is picked by rasterInit()
+int rasterSupports(RasterKernel kernel);
+
+// Bresenham, one pixel at a time, kept as the reference for the benchmark
+void rasterDrawLineReference(Raster *raster, int x1, int y1, int x2, int y2);
+
+#endif
@@ -0,0 +1,173 @@
+#include "svg.h"
+#include <string.h>
+
+// Room left for the view box, which is only known at the end
+#define SVG_VIEW_BOX_CAP 64
+
+// Writer
+void svgFlush(Svg *svg) {
+  if (svg->size && fwrite(svg->buffer, 1, svg->size, svg->file) != (size_t)svg->size) {
+    svg->ok = 0;
+  }
+  svg->written += svg->size;
+  svg->size = 0;
+}
+
+void svgWrite(Svg *svg, char *data, int count) {
+  if (svg->size + count > SVG_BUFFER) {
+    svgFlush(svg);
+  }
+  memcpy(svg->buffer + svg->size, data, count);
+  svg->size += count;
+}
+
+// Writes a number in hundredths, with as few digits as it takes. A space
+// separates it from the number before unless its sign already does.
+void svgNumber(Svg *svg, long long value, int separate) {
+  char digits[32];
+  int count = 0;
+
+  unsigned long long magnitude = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+  int fraction = magnitude % 100;
+  magnitude /= 100;
+
+  if (fraction) {
+    if (fraction % 10) {
+      digits[count++] = '0' + fraction % 10;
+    }
+    digits[count++] = '0' + fraction / 10;
+    digits[count++] = '.';
+  }
+
+  do {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+
+  if (value < 0) {
+    digits[count++] = '-';
+  } else if (separate) {
+    digits[count++] = ' ';
+  }
+
+  if (svg->size + count > SVG_BUFFER) {
+    svgFlush(svg);
+  }
+
+  char *out = svg->buffer + svg->size;
+  for (int i = 0; i < count; i++) {
+    out[i] = digits[count - 1 - i];
+  }
+  svg->size += count;
+}
+
+// Rounds to hundredths, points past a billion units are clamped
+long long svgQuantize(float value) {
+  if (!(value > -1e9f)) {
+    return value != value ? 0 : -100000000000LL;
+  }
+
+  if (value > 1e9f) {
+    return 100000000000LL;
+  }
+
+  double scaled = value * 100.0;
+  return scaled < 0 ? (long long)(scaled - 0.5) : (long long)(scaled + 0.5);
+}
+
+// Svg
+int svgOpen(Svg *svg, char *path) {
+  svg->file = fopen(path, "wb");
+  if (!svg->file) {
+    return 0;
+  }
+
+  svg->size = 0;
+  svg->ok = 1;
+  svg->written = 0;
+  svg->points = 0;
+  svg->x1 = svg->y1 = svg->x2 = svg->y2 = 0;
+
+  char *header = "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"";
+  svgWrite(svg, header, strlen(header));
+  svg->viewBox = svg->written + svg->size;
+
+  char blank[SVG_VIEW_BOX_CAP];
+  memset(blank, ' ', sizeof(blank));
+  svgWrite(svg, blank, sizeof(blank));
+
+  char *group = "\">\n<g fill=\"none\" stroke=\"black\" stroke-linejoin=\"round\">\n";
+  svgWrite(svg, group, strlen(group));
+  return 1;
+}
+
+void svgPoints(void *data, float *xs, float *ys, int count) {
+  Svg *svg = data;
+  for (int i = 0; i < count; i++) {
+    long long x = svgQuantize(xs[i]);
+    long long y = svgQuantize(ys[i]);
+
+    if (!svg->points) {
+      svg->x1 = svg->x2 = x;
+      svg->y1 = svg->y2 = y;
+    }
+
+    svg->x1 = x < svg->x1 ? x : svg->x1;
+    svg->y1 = y < svg->y1 ? y : svg->y1;
+    svg->x2 = x > svg->x2 ? x : svg->x2;
+    svg->y2 = y > svg->y2 ? y : svg->y2;
+
+    // Every call starts a new subpath, the lines after the first are implicit.
+    // Long drawings are split over several paths, which viewers handle better.
+    if (i == 0) {
+      if (!svg->points || svg->pathPoints >= SVG_PATH_CAP) {
+        if (svg->points) {
+          svgWrite(svg, "\"/>\n", 4);
+        }
+        svgWrite(svg, "<path d=\"", 9);
+        svg->pathPoints = 0;
+      }
+
+      svgWrite(svg, "M", 1);
+      svgNumber(svg, x, 0);
+      svgNumber(svg, y, 1);
+    } else {
+      if (i == 1) {
+        svgWrite(svg, "l", 1);
+      }
+      svgNumber(svg, x - svg->x, i > 1);
+      svgNumber(svg, y - svg->y, 1);
+    }
+
+    svg->x = x;
+    svg->y = y;
+    svg->points++;
+    svg->pathPoints++;
+  }
+}
+
+int svgClose(Svg *svg) {
+  if (svg->points) {
+    svgWrite(svg, "\"/>\n", 4);
+  }
+  svgWrite(svg, "</g>\n</svg>\n", 12);
+  svgFlush(svg);
+
+  // The view box leaves half the width of a line around the drawing. Without it
+  // the file is left blank there, which is as broken as a failed write.
+  if (fseek(svg->file, svg->viewBox, SEEK_SET)) {
+    svg->ok = 0;
+  } else {
+    svgNumber(svg, svg->x1 - 50, 0);
+    svgWrite(svg, " ", 1);
+    svgNumber(svg, svg->y1 - 50, 0);
+    svgNumber(svg, svg->x2 - svg->x1 + 100, 1);
+    svgNumber(svg, svg->y2 - svg->y1 + 100, 1);
+    if (svg->size > SVG_VIEW_BOX_CAP) {
+      svg->ok = 0;
+    }
+    svgFlush(svg);
+  }
+
+  return fclose(svg->file) == 0 && svg->ok;
+}
@@ -0,0 +1,40 @@
+#ifndef SVG_H
+#define SVG_H
+
+#include <stdio.h>
+
+// Streams the canvas to an SVG file as path data, without keeping it. Points
+// are written with two decimals, every line relative to the one before, so the
+// rounding never adds up. The view box is filled in by svgClose() once the
+// bounds are known, so the file has to be seekable or closing it fails.
+
+#define SVG_BUFFER (1 << 16)
+#define SVG_PATH_CAP 8192
+
+typedef struct {
+  FILE *file;
+  char buffer[SVG_BUFFER];
+  int size;
+  int ok;
+
+  long written;
+  long viewBox;
+
+  int points;
+  int pathPoints;
+  long long x;
+  long long y;
+
+  long long x1;
+  long long y1;
+  long long x2;
+  long long y2;
+} Svg;
+
+int svgOpen(Svg *svg, char *path);
+int svgClose(Svg *svg);
+
+// Writes count connected points, fits the PenSink of pen.h
+void svgPoints(void *svg, float *xs, float *ys, int count);
+
+#endif
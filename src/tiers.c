@@ -0,0 +1,187 @@
+#include "pen.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs scripts through the stack VM on the ops as compiled and then through the
+// interpreter selected by the flags, and checks that both draw the same canvas,
+// point for point
+//   cc -O2 -ffp-contract=off -DELANG_REGISTER -Isrc -o tiers src/tiers.c -lm && ./tiers example
+
+#if defined(ELANG_JIT_X86_64)
+#define TIERS_NAME "jit"
+#elif defined(ELANG_REGISTER)
+#define TIERS_NAME "register"
+#elif defined(ELANG_COMPUTED_GOTO) && defined(ELANG_FUSE)
+#define TIERS_NAME "threaded, fused"
+#elif defined(ELANG_COMPUTED_GOTO)
+#define TIERS_NAME "threaded"
+#elif defined(ELANG_FUSE)
+#define TIERS_NAME "switch, fused"
+#else
+#define TIERS_NAME "switch"
+#endif
+
+typedef struct {
+  float *xs;
+  float *ys;
+  int *starts;
+  int count;
+  int cap;
+} Points;
+
+void platformClear(void) {}
+
+void platformErrorStart(void) {
+  fprintf(stderr, "ERROR: ");
+}
+
+void platformErrorPush(char *data, int count) {
+  fwrite(data, count, 1, stderr);
+}
+
+void platformErrorEnd(void) {
+  fputc('\n', stderr);
+}
+
+void platformDrawLines(float *points, int count) {}
+
+char *tiersRead(char *path, int *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return 0;
+  }
+
+  char *data = 0;
+  if (!fseek(file, 0, SEEK_END) && (*size = ftell(file)) >= 0 && !fseek(file, 0, SEEK_SET)) {
+    data = malloc(*size + 1);
+    if (data && fread(data, 1, *size, file) != (size_t)*size) {
+      free(data);
+      data = 0;
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+int pointsRead(Points *points) {
+  points->count = 0;
+  while (1) {
+    if (points->count == points->cap) {
+      points->cap = points->cap ? points->cap * 2 : 1024;
+      points->xs = realloc(points->xs, points->cap * sizeof(float));
+      points->ys = realloc(points->ys, points->cap * sizeof(float));
+      points->starts = realloc(points->starts, points->cap * sizeof(int));
+      if (!points->xs || !points->ys || !points->starts) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 0;
+      }
+    }
+
+    int i = points->count;
+    if (!penPoint(i, &points->xs[i], &points->ys[i], &points->starts[i])) {
+      return 1;
+    }
+    points->count++;
+  }
+}
+
+void pointsFree(Points *points) {
+  free(points->xs);
+  free(points->ys);
+  free(points->starts);
+}
+
+// The stack VM on the ops as compiled, before programFinish() translates them
+int tiersReference(void) {
+  ElangVM *vm = penMain.vm;
+#ifdef ELANG_COUNT
+  vm->dispatched = 0;
+#endif
+
+  canvasReset(&penMain.canvas);
+  budgetStart(vm);
+  int ok = stackGrow(vm, vm->opsDepthMax + 1) && elangRunSwitch(vm) && !vm->budgetFailed;
+  canvasFlush(&penMain.canvas);
+  return ok;
+}
+
+int tiersCheck(char *path, Points *expected, Points *actual) {
+  int size = 0;
+  char *data = tiersRead(path, &size);
+  if (!data) {
+    fprintf(stderr, "ERROR: could not read '%s'\n", path);
+    return 0;
+  }
+
+  ElangVM *vm = penMain.vm;
+  int ok = compileProgram(vm, data, size) && tiersReference() && pointsRead(expected);
+#ifdef ELANG_COUNT
+  unsigned long dispatched = vm->dispatched;
+#endif
+
+  ok = ok && programFinish(vm) && penRun(&penMain) && pointsRead(actual);
+  free(data);
+  if (!ok) {
+    fprintf(stderr, "ERROR: could not run '%s'\n", path);
+    return 0;
+  }
+
+#ifdef ELANG_JIT_X86_64
+  // A script the JIT gave up on ran in the interpreter instead
+  if (!vm->jitReady) {
+    fprintf(stderr, "ERROR: %s: the JIT could not compile it\n", path);
+    return 0;
+  }
+#endif
+
+  for (int i = 0; i < expected->count && i < actual->count; i++) {
+    if (memcmp(&actual->xs[i], &expected->xs[i], sizeof(float)) ||
+        memcmp(&actual->ys[i], &expected->ys[i], sizeof(float))) {
+      fprintf(stderr, "ERROR: %s: point %d is (%g, %g), expected (%g, %g)\n", path, i,
+              actual->xs[i], actual->ys[i], expected->xs[i], expected->ys[i]);
+      return 0;
+    }
+
+    if (actual->starts[i] != expected->starts[i]) {
+      fprintf(stderr, "ERROR: %s: point %d %s a stroke, expected it to %s one\n", path, i,
+              actual->starts[i] ? "starts" : "continues", actual->starts[i] ? "continue" : "start");
+      return 0;
+    }
+  }
+
+  if (actual->count != expected->count) {
+    fprintf(stderr, "ERROR: %s: canvas has %d points, expected %d\n", path, actual->count,
+            expected->count);
+    return 0;
+  }
+
+  printf("%s: %d points match (%s)", path, actual->count, TIERS_NAME);
+#if defined(ELANG_COUNT) && !defined(ELANG_JIT_X86_64)
+  printf(", %lu dispatches instead of %lu", vm->dispatched, dispatched);
+#endif
+  printf("\n");
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "ERROR: file path not provided\n");
+    fprintf(stderr, "USAGE: %s <file>...\n", *argv);
+    return 1;
+  }
+
+  penInit();
+
+  Points expected = {0};
+  Points actual = {0};
+  int failed = 0;
+  for (int i = 1; i < argc; i++) {
+    failed += !tiersCheck(argv[i], &expected, &actual);
+  }
+
+  pointsFree(&expected);
+  pointsFree(&actual);
+  return failed != 0;
+}
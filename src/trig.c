@@ -0,0 +1,59 @@
+#include "pen.c"
+#include <math.h>
+#include <stdio.h>
+
+// Checks mathSinCos() against sin() and cos() of libm. The canvas keeps its
+// heading within two turns, larger angles check the range reduction.
+//   cc -O2 -ffp-contract=off -Isrc -o trig src/trig.c -lm && ./trig
+
+#define TRIG_STEPS 10000000
+#define TRIG_ERROR 1e-7
+
+void platformClear(void) {}
+
+void platformErrorStart(void) {}
+
+void platformErrorPush(char *data, int count) {}
+
+void platformErrorEnd(void) {}
+
+void platformDrawLines(float *points, int count) {}
+
+int trigCheck(float range) {
+  double sineError = 0;
+  double cosineError = 0;
+  float sineAt = 0;
+  float cosineAt = 0;
+
+  for (int i = -TRIG_STEPS; i <= TRIG_STEPS; i++) {
+    float x = range * i / TRIG_STEPS;
+    float sine, cosine;
+    mathSinCos(x, &sine, &cosine);
+
+    double error = fabs(sine - sin(x));
+    if (error > sineError) {
+      sineError = error;
+      sineAt = x;
+    }
+
+    error = fabs(cosine - cos(x));
+    if (error > cosineError) {
+      cosineError = error;
+      cosineAt = x;
+    }
+  }
+
+  printf("|x| <= %g: sin error %.3g at %g, cos error %.3g at %g\n", range, sineError, sineAt,
+         cosineError, cosineAt);
+  if (sineError > TRIG_ERROR || cosineError > TRIG_ERROR) {
+    fprintf(stderr, "ERROR: |x| <= %g is off by more than %g\n", range, TRIG_ERROR);
+    return 0;
+  }
+  return 1;
+}
+
+int main(void) {
+  int ok = trigCheck(PI * 2);
+  ok = trigCheck(1000) && ok;
+  return !ok;
+}
@@ -1,6 +1,12 @@
 window.onload = async () => {
   const app = document.getElementById("app")
-  const ctx = app.getContext("2d")
+  const screen = app.getContext("2d")
+
+  // The canvas is rendered offscreen and only redrawn when the script is run
+  // again, the size changes or the colors do
+  const cache = document.createElement("canvas")
+  const ctx = cache.getContext("2d")
+  let drawn = null
 
   const run = document.getElementById("run")
   const input = document.getElementById("input")
@@ -13,7 +19,7 @@ window.onload = async () => {
     env: {
       platformClear: () => {
         ctx.fillStyle = style.backgroundColor
-        ctx.fillRect(0, 0, app.width, app.height)
+        ctx.fillRect(0, 0, cache.width, cache.height)
       },
 
       platformErrorStart: () => {
@@ -27,6 +33,20 @@ window.onload = async () => {
 
       platformErrorEnd: () => { },
 
+      platformNow: () => performance.now(),
+
+      platformDrawLines: (start, count) => {
+        const points = new Float32Array(memory.buffer, start, count * 2)
+        ctx.beginPath()
+        ctx.moveTo(points[0], points[1])
+        for (let i = 2; i < points.length; i += 2) {
+          ctx.lineTo(points[i], points[i + 1])
+        }
+        ctx.strokeStyle = style.color
+        ctx.stroke()
+      },
+
+      // A web/pen.wasm from before the line strips draws a line per call
       platformDrawLine: (x1, y1, x2, y2) => {
         ctx.beginPath()
         ctx.moveTo(x1, y1)
@@ -39,6 +59,22 @@ window.onload = async () => {
 
   const { memory, penInit, penRender, penUpdate } = wasm.instance.exports
 
+  // Without penGeneration every run is taken to change the canvas
+  let runs = 0
+  const penGeneration = wasm.instance.exports.penGeneration || (() => runs)
+
+  const render = () => {
+    const key = [penGeneration(), app.width, app.height, style.color, style.backgroundColor].join()
+    if (key !== drawn) {
+      drawn = key
+      cache.width = app.width
+      cache.height = app.height
+      penRender(cache.width, cache.height)
+    }
+
+    screen.drawImage(cache, 0, 0)
+  }
+
   penInit()
   run.onclick = () => {
     const array = new Uint8Array(memory.buffer, 0, input.value.length)
@@ -47,8 +83,9 @@ window.onload = async () => {
     error.value = ""
     error.style.backgroundColor = "#00FF0066"
 
+    runs++
     penUpdate(array.byteOffset, array.length)
-    penRender(app.width, app.height)
+    render()
 
     if (error.value) {
       const line = Number(error.value.slice(error.value.lastIndexOf(" ")))
@@ -69,11 +106,11 @@ window.onload = async () => {
   window.onresize = () => {
     app.width = window.innerWidth * 0.6
     app.height = window.innerHeight - errorSpace
-    penRender(app.width, app.height)
+    render()
   }
 
   window.onresize()
 
-  new MutationObserver(() => penRender(app.width, app.height))
+  new MutationObserver(render)
     .observe(document.querySelector("head"), { childList: true })
 }